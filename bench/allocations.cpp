@@ -0,0 +1,90 @@
+#include "allocations.hpp"
+
+#include <atomic>
+#include <cstdlib>
+#include <new>
+
+#if defined(__APPLE__)
+#include <malloc/malloc.h>
+#elif defined(__GLIBC__)
+#include <malloc.h>
+#endif
+
+using namespace std;
+
+// the memory really taken by an allocation, 0 where it cannot be known
+static size_t usable_size(void *ptr)
+{
+#if defined(__APPLE__)
+  return malloc_size(ptr);
+#elif defined(__GLIBC__)
+  return malloc_usable_size(ptr);
+#else
+  (void)ptr;
+  return 0;
+#endif
+}
+
+// updated by the worker threads of the parallel phases as well
+static atomic<size_t> s_count(0);
+static atomic<size_t> s_bytes(0);
+static atomic<size_t> s_live(0);
+static atomic<size_t> s_peak(0);
+
+size_t allocation_count()
+{
+  return s_count;
+}
+
+size_t allocated_bytes()
+{
+  return s_bytes;
+}
+
+size_t live_bytes()
+{
+  return s_live;
+}
+
+size_t peak_bytes()
+{
+  return s_peak;
+}
+
+void reset_peak_bytes()
+{
+  s_peak = s_live.load();
+}
+
+void *operator new(size_t size)
+{
+  s_count.fetch_add(1, memory_order_relaxed);
+  s_bytes.fetch_add(size, memory_order_relaxed);
+
+  if(void *ptr = malloc(size)) {
+    const size_t usable = usable_size(ptr);
+    const size_t live =
+      s_live.fetch_add(usable, memory_order_relaxed) + usable;
+
+    size_t peak = s_peak.load(memory_order_relaxed);
+
+    while(live > peak &&
+        !s_peak.compare_exchange_weak(peak, live, memory_order_relaxed));
+
+    return ptr;
+  }
+
+  throw bad_alloc();
+}
+
+void operator delete(void *ptr) noexcept
+{
+  s_live.fetch_sub(usable_size(ptr), memory_order_relaxed);
+  free(ptr);
+}
+
+void operator delete(void *ptr, size_t) noexcept
+{
+  s_live.fetch_sub(usable_size(ptr), memory_order_relaxed);
+  free(ptr);
+}
@@ -0,0 +1,16 @@
+#ifndef ALLOCATIONS_HPP
+#define ALLOCATIONS_HPP
+
+#include <cstddef>
+
+// counters of the global operator new replacement
+size_t allocation_count();
+size_t allocated_bytes();
+
+// heap memory currently in use, and the most used since the last reset,
+// always 0 where the C library cannot tell the size of an allocation
+size_t live_bytes();
+size_t peak_bytes();
+void reset_peak_bytes();
+
+#endif
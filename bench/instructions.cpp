@@ -0,0 +1,43 @@
+#include "instructions.hpp"
+
+#ifdef __linux__
+
+#include <cstring>
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+static int open_counter()
+{
+  perf_event_attr attr;
+  memset(&attr, 0, sizeof(attr));
+  attr.type = PERF_TYPE_HARDWARE;
+  attr.size = sizeof(attr);
+  attr.config = PERF_COUNT_HW_INSTRUCTIONS;
+  attr.exclude_kernel = 1;
+  attr.exclude_hv = 1;
+  attr.inherit = 1;
+
+  return syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+}
+
+long long instruction_count()
+{
+  static const int fd = open_counter();
+
+  long long count;
+
+  if(fd < 0 || read(fd, &count, sizeof(count)) != sizeof(count))
+    return -1;
+
+  return count;
+}
+
+#else
+
+long long instruction_count()
+{
+  return -1;
+}
+
+#endif
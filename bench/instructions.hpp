@@ -0,0 +1,9 @@
+#ifndef INSTRUCTIONS_HPP
+#define INSTRUCTIONS_HPP
+
+// Instructions retired by the process in user space so far, read from the
+// hardware performance counters. Returns -1 when they are unavailable (no
+// PMU in a virtual machine, restricted perf_event_paranoid, not Linux...).
+long long instruction_count();
+
+#endif
@@ -0,0 +1,128 @@
+#include "kernels.hpp"
+
+#include <algorithm>
+#include <boost/algorithm/string/replace.hpp>
+#include <boost/format.hpp>
+#include <chrono>
+#include <functional>
+#include <sstream>
+#include <string>
+
+#include "../src/scan.hpp"
+#include "../src/tokens.hpp"
+
+using namespace std;
+using format = boost::format;
+
+// prose with a quote and a line break every few dozen characters, like
+// the copyright notices and markup of the headers
+static string make_text(const size_t size)
+{
+  const string line = "Copyright (c) 2016 The \"partman\" authors. "
+    "All rights reserved, see LICENSE\n";
+
+  string text;
+  text.reserve(size + line.size());
+
+  while(text.size() < size)
+    text += line;
+
+  text.resize(size);
+  return text;
+}
+
+static void escape_boost(ostream &stream, const string &text)
+{
+  using boost::algorithm::replace_all_copy;
+
+  const string quoted = replace_all_copy(text, "\"", "\\\"");
+  stream << '"' << replace_all_copy(quoted, "\n", "\n  ") << '"';
+}
+
+static void escape_with(ostream &stream, const string &text,
+  const ScanFunction scan)
+{
+  const char *it = text.data(), *end = it + text.size(), *found;
+
+  stream.put('"');
+
+  while((found = scan(it, end)) != end) {
+    stream.write(it, found - it);
+
+    if(*found == '\n')
+      stream.write("\n  ", 3);
+    else
+      stream.write("\\\"", 2);
+
+    it = found + 1;
+  }
+
+  stream.write(it, end - it);
+  stream.put('"');
+}
+
+static double fastest(const unsigned int runs,
+  const function<void(ostream &)> &func)
+{
+  double best = 0;
+
+  for(unsigned int i = 0; i < max(runs, 1u); i++) {
+    ostringstream stream;
+
+    const auto start = chrono::steady_clock::now();
+    func(stream);
+    const double seconds = chrono::duration<double>(
+      chrono::steady_clock::now() - start).count();
+
+    if(i == 0 || seconds < best)
+      best = seconds;
+  }
+
+  return best;
+}
+
+void run_kernels(ostream &stream, const size_t text_bytes,
+  const unsigned int runs)
+{
+  const string text = make_text(text_bytes);
+  const String token(text);
+
+  const pair<const char *, ScanFunction> kernels[] = {
+    {"scalar", scalar_scan()},
+    {"sse2", sse2_scan()},
+    {"avx2", avx2_scan()},
+  };
+
+  bool first = true;
+
+  const auto print = [&](const char *name, const double seconds) {
+    stream << format("%s    \"%s\": {\"seconds\": %.6f, "
+      "\"throughput_mbps\": %.3f}") % (first ? "" : ",\n") % name % seconds
+      % (text_bytes / seconds / 1e6);
+
+    first = false;
+  };
+
+  stream << "{\n";
+  stream << format("  \"text_bytes\": %d,\n") % text_bytes;
+  stream << format("  \"selected\": \"%s\",\n") % scan_kernel();
+  stream << "  \"kernels\": {\n";
+  print("boost_replace_all", fastest(runs, [&](ostream &out) {
+    escape_boost(out, text);
+  }));
+
+  for(const auto &kernel : kernels) {
+    if(!kernel.second)
+      continue;
+
+    print(kernel.first, fastest(runs, [&](ostream &out) {
+      escape_with(out, text, kernel.second);
+    }));
+  }
+
+  print("string_token", fastest(runs, [&](ostream &out) {
+    token.write(out, 1);
+  }));
+
+  stream << "\n  }\n}\n";
+}
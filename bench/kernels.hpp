@@ -0,0 +1,11 @@
+#ifndef KERNELS_HPP
+#define KERNELS_HPP
+
+#include <cstddef>
+#include <ostream>
+
+// Microbenchmarks of the string escaping and indentation against the former
+// boost::replace_all_copy implementation, on text of the given size.
+void run_kernels(std::ostream &, size_t text_bytes, unsigned int runs);
+
+#endif
@@ -0,0 +1,331 @@
+#include <boost/format.hpp>
+#include <boost/program_options.hpp>
+#include <chrono>
+#include <iostream>
+#include <sstream>
+#include <yaml-cpp/yaml.h>
+
+#include "../src/flat.hpp"
+#include "../src/generators.hpp"
+#include "../src/parser.hpp"
+#include "../src/reader.hpp"
+#include "allocations.hpp"
+#include "instructions.hpp"
+#include "kernels.hpp"
+#include "synthetic.hpp"
+
+using namespace std;
+using namespace boost;
+
+struct Measure
+{
+  Measure()
+    : seconds(0), allocations(0), allocated_bytes(0), peak_bytes(0),
+      instructions(0) {}
+
+  double seconds;
+  size_t allocations;
+  size_t allocated_bytes;
+  size_t peak_bytes;
+  long long instructions; // -1 if unavailable
+};
+
+class Stopwatch
+{
+public:
+  Stopwatch()
+    : m_start(chrono::steady_clock::now()),
+      m_allocations(allocation_count()), m_allocated_bytes(allocated_bytes()),
+      m_live_bytes(live_bytes()), m_instructions(instruction_count())
+  {
+    reset_peak_bytes();
+  }
+
+  Measure stop() const
+  {
+    Measure m;
+    m.seconds = chrono::duration<double>(
+      chrono::steady_clock::now() - m_start).count();
+    m.allocations = allocation_count() - m_allocations;
+    m.allocated_bytes = allocated_bytes() - m_allocated_bytes;
+    m.peak_bytes = peak_bytes() - m_live_bytes;
+
+    const long long instructions = instruction_count();
+    m.instructions = instructions < 0 ? -1 : instructions - m_instructions;
+
+    return m;
+  }
+
+private:
+  chrono::steady_clock::time_point m_start;
+  size_t m_allocations;
+  size_t m_allocated_bytes;
+  size_t m_live_bytes;
+  long long m_instructions;
+};
+
+struct Run
+{
+  Measure parse;
+  Measure build;
+  Measure read;
+  Measure flatten;
+  Measure emit;
+  Measure reemit;
+  size_t output_bytes;
+};
+
+static Measure operator+(const Measure &a, const Measure &b)
+{
+  Measure m;
+  m.seconds = a.seconds + b.seconds;
+  m.allocations = a.allocations + b.allocations;
+  m.allocated_bytes = a.allocated_bytes + b.allocated_bytes;
+  m.peak_bytes = max(a.peak_bytes, b.peak_bytes);
+  m.instructions = a.instructions < 0 || b.instructions < 0 ? -1
+    : a.instructions + b.instructions;
+  return m;
+}
+
+enum Syntax { YAML_NODES, YAML_EVENTS, PARTMAN };
+
+static Run run(const string &input, const Syntax syntax, const bool arena,
+  const unsigned int jobs, const size_t render_threshold, const bool flat)
+{
+  Run result;
+
+  Document doc(arena);
+
+  // with the streaming readers, parsing and building are a single pass
+  if(syntax == PARTMAN) {
+    Stopwatch read;
+    Parser(doc).parse(input.data(), input.size());
+    result.read = read.stop();
+  }
+  else if(syntax == YAML_EVENTS) {
+    istringstream stream(input);
+
+    Stopwatch read;
+    YamlReader(doc, nullptr, jobs).read(stream);
+    result.read = read.stop();
+  }
+  else {
+    Stopwatch parse;
+    const vector<YAML::Node> yaml = YAML::LoadAll(input);
+    result.parse = parse.stop();
+
+    Stopwatch build;
+    for(const YAML::Node &root : yaml)
+      doc.read_yaml(root);
+    result.build = build.stop();
+
+    // the YAML nodes are alive until the end of the build phase
+    result.read = result.parse + result.build;
+    result.read.peak_bytes = result.parse.peak_bytes + result.build.peak_bytes;
+  }
+
+  ostringstream output;
+
+  if(flat) {
+    Stopwatch flatten;
+    const FlatTree tree(doc.token());
+    result.flatten = flatten.stop();
+
+    Stopwatch emit;
+    output << tree;
+    result.emit = emit.stop();
+
+    result.output_bytes = output.tellp();
+
+    ostringstream again;
+
+    Stopwatch reemit;
+    again << tree;
+    result.reemit = reemit.stop();
+
+    return result;
+  }
+
+  const ParallelWrite render{jobs, render_threshold};
+
+  if(render_threshold > 0)
+    set_parallel(output, &render);
+
+  Stopwatch emit;
+  output << doc.token();
+  result.emit = emit.stop();
+
+  result.output_bytes = output.tellp();
+
+  // the blocks cached by the first write are reused
+  ostringstream again;
+
+  if(render_threshold > 0)
+    set_parallel(again, &render);
+
+  Stopwatch reemit;
+  again << doc.token();
+  result.reemit = reemit.stop();
+
+  return result;
+}
+
+static void keep_fastest(Measure &best, const Measure &current)
+{
+  // allocation counts are those of the first (cold) run
+  best.seconds = min(best.seconds, current.seconds);
+}
+
+static void print(ostream &stream, const char *name, const Measure &m,
+  const size_t bytes)
+{
+  const string instructions =
+    m.instructions < 0 ? "null" : to_string(m.instructions);
+
+  stream << format("    \"%s\": {\"seconds\": %.6f, \"allocations\": %d, "
+    "\"allocated_bytes\": %d, \"peak_bytes\": %d, \"instructions\": %s, "
+    "\"throughput_mbps\": %.3f}")
+    % name % m.seconds % m.allocations % m.allocated_bytes % m.peak_bytes
+    % instructions % (bytes / m.seconds / 1e6);
+}
+
+int main(int argc, char *argv[])
+{
+  namespace po = program_options;
+
+  SyntheticScore params;
+  unsigned int runs;
+  unsigned int jobs;
+  size_t render_threshold;
+  size_t kernel_bytes;
+  string syntax;
+
+  po::options_description desc("partman benchmark");
+  desc.add_options()
+    ("parts", po::value(&params.parts)->default_value(params.parts),
+     "number of top-level parts")
+    ("depth", po::value(&params.depth)->default_value(params.depth),
+     "sub-part nesting depth")
+    ("sub-parts", po::value(&params.sub_parts)
+      ->default_value(params.sub_parts), "sub-parts per nesting level")
+    ("scores", po::value(&params.scores)->default_value(params.scores),
+     "number of scores")
+    ("books", po::value(&params.books)->default_value(params.books),
+     "number of books (of two scores each)")
+    ("header-keys", po::value(&params.header_keys)
+      ->default_value(params.header_keys), "number of header keys")
+    ("paper-keys", po::value(&params.paper_keys)
+      ->default_value(params.paper_keys), "number of paper keys")
+    ("runs", po::value(&runs)->default_value(5),
+     "number of runs (the fastest time is reported)")
+    ("syntax", po::value(&syntax)->default_value("yaml"),
+     "input syntax (yaml, yaml-events or partman)")
+    ("arena", "allocate the document tokens in an arena")
+    ("flat", "write the document through a flat copy of its tokens")
+    ("jobs", po::value(&jobs)->default_value(1),
+     "threads building the parts (yaml-events only) and rendering")
+    ("render-threshold", po::value(&render_threshold)->default_value(0),
+     "render the children of blocks having at least N of them in parallel "
+     "(0 disables)")
+    ("kernels", po::value(&kernel_bytes)->value_name("BYTES"),
+     "benchmark the string escaping kernels on BYTES of text and exit")
+    ("dump", "output the generated input and exit")
+    ("help,h", "display this help and exit")
+  ;
+
+  po::variables_map opts;
+
+  try {
+    po::store(po::parse_command_line(argc, argv, desc), opts);
+    po::notify(opts);
+  }
+  catch(po::error &err) {
+    cerr << err.what() << endl << endl;
+    cerr << desc;
+    return EXIT_FAILURE;
+  }
+
+  if(opts.count("help")) {
+    cout << desc;
+    return EXIT_SUCCESS;
+  }
+
+  if(opts.count("kernels")) {
+    run_kernels(cout, kernel_bytes, runs);
+    return EXIT_SUCCESS;
+  }
+
+  Syntax input_syntax;
+
+  if(syntax == "yaml")
+    input_syntax = YAML_NODES;
+  else if(syntax == "yaml-events")
+    input_syntax = YAML_EVENTS;
+  else if(syntax == "partman")
+    input_syntax = PARTMAN;
+  else {
+    cerr << format("unknown syntax '%s'") % syntax << endl;
+    return EXIT_FAILURE;
+  }
+
+  const string input = input_syntax == PARTMAN ?
+    generate_partman(params) : generate_yaml(params);
+
+  if(opts.count("dump")) {
+    cout << input;
+    return EXIT_SUCCESS;
+  }
+
+  const bool arena = opts.count("arena") > 0;
+  const bool flat = opts.count("flat") > 0;
+
+  Run best;
+
+  for(unsigned int i = 0; i < max(runs, 1u); i++) {
+    const Run current = run(input, input_syntax, arena, jobs,
+      render_threshold, flat);
+
+    if(i == 0)
+      best = current;
+    else {
+      keep_fastest(best.parse, current.parse);
+      keep_fastest(best.build, current.build);
+      keep_fastest(best.read, current.read);
+      keep_fastest(best.flatten, current.flatten);
+      keep_fastest(best.emit, current.emit);
+      keep_fastest(best.reemit, current.reemit);
+    }
+  }
+
+  cout << "{\n";
+  cout << format("  \"parameters\": {\"parts\": %d, \"depth\": %d, "
+    "\"sub_parts\": %d, \"scores\": %d, \"books\": %d, \"header_keys\": %d, "
+    "\"paper_keys\": %d, \"syntax\": \"%s\", \"arena\": %s, \"flat\": %s, "
+    "\"jobs\": %d, \"render_threshold\": %d, \"runs\": %d},\n")
+    % params.parts % params.depth % params.sub_parts % params.scores
+    % params.books % params.header_keys % params.paper_keys % syntax
+    % (arena ? "true" : "false")
+    % (flat ? "true" : "false") % jobs % render_threshold % runs;
+  cout << format("  \"input_bytes\": %d,\n") % input.size();
+  cout << format("  \"output_bytes\": %d,\n") % best.output_bytes;
+  cout << "  \"phases\": {\n";
+  if(input_syntax == YAML_NODES) {
+    print(cout, "parse", best.parse, input.size());
+    cout << ",\n";
+    print(cout, "build", best.build, best.output_bytes);
+    cout << ",\n";
+  }
+  print(cout, "read", best.read, input.size());
+  cout << ",\n";
+  if(flat) {
+    print(cout, "flatten", best.flatten, best.output_bytes);
+    cout << ",\n";
+  }
+  print(cout, "emit", best.emit, best.output_bytes);
+  cout << ",\n";
+  print(cout, "reemit", best.reemit, best.output_bytes);
+  cout << "\n  }\n";
+  cout << "}\n";
+
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,226 @@
+#include "synthetic.hpp"
+
+#include <boost/format.hpp>
+#include <sstream>
+
+using namespace std;
+using format = boost::format;
+
+const unsigned int GROUP_SIZE = 4;
+
+SyntheticScore::SyntheticScore()
+  : parts(100), depth(1), sub_parts(2), scores(1), books(0),
+    header_keys(4), paper_keys(4)
+{
+}
+
+static string indent(const unsigned int level)
+{
+  return string(level * 2, '\x20');
+}
+
+static void write_keys(ostream &stream, const string &prefix,
+  const unsigned int count)
+{
+  for(unsigned int i = 0; i < count; i++) {
+    stream << indent(1) << prefix << i << ": ";
+
+    switch(i % 3) {
+    case 0:
+      stream << format("\"%s %d \\\"quoted\\\"\"") % prefix % i;
+      break;
+    case 1:
+      stream << format("%d.5\\cm") % i;
+      break;
+    case 2:
+      stream << (i % 2 ? "true" : "false");
+      break;
+    }
+
+    stream << "\n";
+  }
+}
+
+static void write_part(ostream &stream, const string &name,
+  const unsigned int level, const SyntheticScore &params,
+  const unsigned int depth)
+{
+  stream << indent(level) << name << ":\n";
+  stream << indent(level + 1) << format("name: [\"%s\", \"%s.\"]\n")
+    % name % name.substr(0, 3);
+  stream << indent(level + 1) << "instrument: \"acoustic grand\"\n";
+
+  if(depth < params.depth && params.sub_parts) {
+    stream << indent(level + 1) << "type: PianoStaff\n";
+    stream << indent(level + 1) << "parts:\n";
+
+    for(unsigned int i = 0; i < params.sub_parts; i++) {
+      write_part(stream, (format("s%d") % i).str(), level + 2,
+        params, depth + 1);
+    }
+  }
+  else
+    stream << indent(level + 1) << "relative: c''\n";
+}
+
+static void write_score(ostream &stream, const unsigned int level,
+  const SyntheticScore &params, const bool first_item)
+{
+  const string item = first_item ? "- " : "";
+  const string lead = indent(level) + item;
+  const string next = indent(level) + string(item.size(), '\x20');
+
+  stream << lead << "parts:\n";
+
+  for(unsigned int i = 0; i < params.parts; i += GROUP_SIZE) {
+    stream << next << indent(1) << "- [";
+
+    for(unsigned int j = i; j < min(i + GROUP_SIZE, params.parts); j++)
+      stream << (j == i ? "" : ", ") << "part" << j;
+
+    stream << "]\n";
+  }
+
+  stream << next << "layout:\n";
+  stream << next << indent(1) << "indent: 1\\cm\n";
+  stream << next << "midi:\n";
+  stream << next << indent(1) << "tempo: 4 = 60\n";
+}
+
+string generate_yaml(const SyntheticScore &params)
+{
+  ostringstream stream;
+
+  stream << "---\n";
+  stream << "header:\n";
+  write_keys(stream, "header", params.header_keys);
+
+  stream << "paper:\n";
+  stream << indent(1) << "paper-size: \"a4\"\n";
+  write_keys(stream, "paper", params.paper_keys);
+
+  stream << "setup:\n";
+  stream << indent(1) << "key: c \\major\n";
+  stream << indent(1) << "time: 4/4\n";
+
+  stream << "parts:\n";
+  for(unsigned int i = 0; i < params.parts; i++)
+    write_part(stream, (format("part%d") % i).str(), 1, params, 0);
+
+  // each document may only have one score or book key
+  for(unsigned int i = 0; i < params.scores; i++) {
+    stream << "---\nscore:\n";
+    write_score(stream, 1, params, false);
+  }
+
+  for(unsigned int i = 0; i < params.books; i++) {
+    stream << "---\nbook:\n";
+    write_score(stream, 1, params, true);
+    write_score(stream, 1, params, true);
+  }
+
+  return stream.str();
+}
+
+static void write_partman_keys(ostream &stream, const string &prefix,
+  const unsigned int count)
+{
+  for(unsigned int i = 0; i < count; i++) {
+    stream << indent(1) << prefix << i << " = ";
+
+    switch(i % 3) {
+    case 0:
+      stream << format("\"%s %d \\\"quoted\\\"\"") % prefix % i;
+      break;
+    case 1:
+      stream << format("%d.5\\cm") % i;
+      break;
+    case 2:
+      stream << (i % 2 ? "true" : "false");
+      break;
+    }
+
+    stream << "\n";
+  }
+}
+
+static void write_partman_part(ostream &stream, const string &name,
+  const unsigned int level, const SyntheticScore &params,
+  const unsigned int depth)
+{
+  stream << indent(level) << name << " {\n";
+  stream << indent(level + 1) << format("name = \"%s\" \"%s.\"\n")
+    % name % name.substr(0, 3);
+  stream << indent(level + 1) << "instrument = \"acoustic grand\"\n";
+
+  if(depth < params.depth && params.sub_parts) {
+    stream << indent(level + 1) << "type = PianoStaff\n";
+    stream << indent(level + 1) << "\\parts {\n";
+
+    for(unsigned int i = 0; i < params.sub_parts; i++) {
+      write_partman_part(stream, (format("s%d") % i).str(), level + 2,
+        params, depth + 1);
+    }
+
+    stream << indent(level + 1) << "}\n";
+  }
+  else
+    stream << indent(level + 1) << "relative = c''\n";
+
+  stream << indent(level) << "}\n";
+}
+
+static void write_partman_score(ostream &stream, const unsigned int level,
+  const SyntheticScore &params)
+{
+  stream << indent(level) << "\\score {\n";
+
+  for(unsigned int i = 0; i < params.parts; i += GROUP_SIZE) {
+    stream << indent(level + 1) << "<<";
+
+    for(unsigned int j = i; j < min(i + GROUP_SIZE, params.parts); j++)
+      stream << " part" << j;
+
+    stream << " >>\n";
+  }
+
+  stream << indent(level + 1) << "\\layout { indent = 1\\cm }\n";
+  stream << indent(level + 1) << "\\midi { tempo = 4 = 60 }\n";
+  stream << indent(level) << "}\n";
+}
+
+string generate_partman(const SyntheticScore &params)
+{
+  ostringstream stream;
+
+  stream << "\\header {\n";
+  write_partman_keys(stream, "header", params.header_keys);
+  stream << "}\n";
+
+  stream << "\\paper {\n";
+  stream << indent(1) << "paper-size = \"a4\"\n";
+  write_partman_keys(stream, "paper", params.paper_keys);
+  stream << "}\n";
+
+  stream << "\\setup {\n";
+  stream << indent(1) << "key = c \\major\n";
+  stream << indent(1) << "time = 4/4\n";
+  stream << "}\n";
+
+  stream << "\\parts {\n";
+  for(unsigned int i = 0; i < params.parts; i++)
+    write_partman_part(stream, (format("part%d") % i).str(), 1, params, 0);
+  stream << "}\n";
+
+  for(unsigned int i = 0; i < params.scores; i++)
+    write_partman_score(stream, 0, params);
+
+  for(unsigned int i = 0; i < params.books; i++) {
+    stream << "\\book {\n";
+    write_partman_score(stream, 1, params);
+    write_partman_score(stream, 1, params);
+    stream << "}\n";
+  }
+
+  return stream.str();
+}
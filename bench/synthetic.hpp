@@ -0,0 +1,22 @@
+#ifndef SYNTHETIC_HPP
+#define SYNTHETIC_HPP
+
+#include <string>
+
+struct SyntheticScore
+{
+  SyntheticScore();
+
+  unsigned int parts;
+  unsigned int depth;
+  unsigned int sub_parts;
+  unsigned int scores;
+  unsigned int books;
+  unsigned int header_keys;
+  unsigned int paper_keys;
+};
+
+std::string generate_yaml(const SyntheticScore &);
+std::string generate_partman(const SyntheticScore &);
+
+#endif
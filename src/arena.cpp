@@ -0,0 +1,44 @@
+#include "arena.hpp"
+
+#include <cstdint>
+
+using namespace std;
+
+Arena::Arena(const size_t chunk_size)
+  : m_chunk_size(chunk_size), m_head(nullptr), m_left(0)
+{
+}
+
+Arena::~Arena()
+{
+  // the tokens die together, in no particular order
+  for(Token *token : m_tokens)
+    token->m_detached = true;
+
+  for(auto it = m_tokens.rbegin(); it != m_tokens.rend(); it++)
+    (*it)->~Token();
+
+  for(char *chunk : m_chunks)
+    delete[] chunk;
+}
+
+void *Arena::allocate(const size_t size, const size_t align)
+{
+  size_t padding = (align - (uintptr_t)m_head % align) % align;
+
+  if(!m_head || padding + size > m_left) {
+    const size_t chunk_size = max(m_chunk_size, size + align);
+
+    m_chunks.push_back(new char[chunk_size]);
+    m_head = m_chunks.back();
+    m_left = chunk_size;
+
+    padding = (align - (uintptr_t)m_head % align) % align;
+  }
+
+  void *ptr = m_head + padding;
+  m_head += padding + size;
+  m_left -= padding + size;
+
+  return ptr;
+}
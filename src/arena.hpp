@@ -0,0 +1,45 @@
+#ifndef ARENA_HPP
+#define ARENA_HPP
+
+#include <cstddef>
+#include <utility>
+#include <vector>
+
+#include "tokens.hpp"
+
+class Arena
+{
+public:
+  Arena(const size_t chunk_size = 64 * 1024);
+  Arena(const Arena &) = delete;
+  ~Arena();
+
+  Arena &operator=(const Arena &) = delete;
+
+  // The returned pointer does not own the token (it has no control block, so
+  // copying it costs no refcount update). Every token lives until the arena
+  // is destroyed.
+  template <class T, class... Args>
+  TokenPtr<T> make(Args &&... args)
+  {
+    T *token = new (allocate(sizeof(T), alignof(T)))
+      T(std::forward<Args>(args)...);
+    m_tokens.push_back(token);
+
+    return TokenPtr<T>(TokenPtr<T>(), token);
+  }
+
+  size_t size() const { return m_tokens.size(); }
+
+private:
+  void *allocate(size_t size, size_t align);
+
+  size_t m_chunk_size;
+  std::vector<char *> m_chunks;
+  char *m_head;
+  size_t m_left;
+
+  std::vector<Token *> m_tokens;
+};
+
+#endif
@@ -0,0 +1,167 @@
+#include "cache.hpp"
+
+#include <boost/format.hpp>
+#include <fstream>
+#include <sstream>
+
+#include "hash.hpp"
+#include "output.hpp"
+
+using namespace std;
+using format = boost::format;
+
+// bump whenever the generated code of a fragment changes
+const string CACHE_MAGIC = "partman-fragment 2";
+
+FragmentCache::FragmentCache(const string &directory, const bool compact)
+  : m_directory(directory), m_compact(compact)
+{
+  if(!directory.empty())
+    make_directory(directory);
+}
+
+uint64_t FragmentCache::entry_key(const uint64_t key) const
+{
+  static const char COMPACT = 'c';
+  return m_compact ? hash_bytes(&COMPACT, sizeof(COMPACT), key) : key;
+}
+
+string FragmentCache::path(const uint64_t key) const
+{
+  return (format("%s/%016x") % m_directory % key).str();
+}
+
+// strings are stored as "<size>\n<bytes>" so they may contain anything,
+// the sizes of a corrupt entry must not exceed the end of the file
+static bool read_string(istream &stream, const size_t file_size, string *str)
+{
+  size_t size;
+
+  if(!(stream >> size) || stream.get() != '\n')
+    return false;
+
+  const streamoff offset = stream.tellg();
+
+  if(offset < 0 || size > file_size - offset)
+    return false;
+
+  str->resize(size);
+  return size == 0 || stream.read(&(*str)[0], size);
+}
+
+static void write_string(ostream &stream, const string &str)
+{
+  stream << str.size() << '\n' << str;
+}
+
+void FragmentCache::render(const TokenPtr<> &token, Fragment *fragment) const
+{
+  fragment->code = token->code();
+  fragment->compact_code.clear();
+
+  if(m_compact) {
+    ostringstream stream;
+    set_compact(stream, true);
+
+    stream << token;
+    fragment->compact_code = stream.str();
+  }
+}
+
+bool FragmentCache::load(uint64_t key, Fragment *fragment) const
+{
+  key = entry_key(key);
+
+  {
+    lock_guard<mutex> lock(m_mutex);
+    const auto match = m_fragments.find(key);
+
+    if(match != m_fragments.end()) {
+      *fragment = match->second;
+      return true;
+    }
+  }
+
+  if(m_directory.empty())
+    return false;
+
+  // a broken entry is only a miss
+  Fragment loaded;
+
+  try {
+    if(!read_entry(path(key), &loaded))
+      return false;
+  }
+  catch(const std::exception &) {
+    return false;
+  }
+
+  *fragment = loaded;
+
+  lock_guard<mutex> lock(m_mutex);
+  m_fragments.emplace(key, std::move(loaded));
+
+  return true;
+}
+
+bool FragmentCache::read_entry(const string &path, Fragment *fragment)
+{
+  ifstream stream(path, ios::binary | ios::ate);
+
+  const streamoff file_size = stream.tellg();
+
+  if(file_size < 0 || !stream.seekg(0))
+    return false;
+
+  string magic;
+  size_t count;
+
+  if(!getline(stream, magic) || magic != CACHE_MAGIC || !(stream >> count))
+    return false;
+
+  // an identifier takes at least two empty strings: "0\n0\n"
+  if(count > static_cast<size_t>(file_size) / 4)
+    return false;
+
+  fragment->identifiers.resize(count);
+
+  for(auto &entry : fragment->identifiers) {
+    if(!read_string(stream, file_size, &entry.first) ||
+        !read_string(stream, file_size, &entry.second))
+      return false;
+  }
+
+  return read_string(stream, file_size, &fragment->code) &&
+    read_string(stream, file_size, &fragment->compact_code);
+}
+
+void FragmentCache::store(uint64_t key, const Fragment &fragment) const
+{
+  key = entry_key(key);
+
+  {
+    lock_guard<mutex> lock(m_mutex);
+    m_fragments[key] = fragment;
+  }
+
+  if(m_directory.empty())
+    return;
+
+  // a cache that cannot be written only costs time
+  try {
+    FileSink sink(path(key));
+    ostream stream(&sink);
+
+    stream << CACHE_MAGIC << '\n' << fragment.identifiers.size() << '\n';
+
+    for(const auto &entry : fragment.identifiers) {
+      write_string(stream, entry.first);
+      write_string(stream, entry.second);
+    }
+
+    write_string(stream, fragment.code);
+    write_string(stream, fragment.compact_code);
+    sink.commit();
+  }
+  catch(const std::exception &) {}
+}
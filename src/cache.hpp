@@ -0,0 +1,52 @@
+#ifndef CACHE_HPP
+#define CACHE_HPP
+
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+#include "identifiers.hpp"
+#include "tokens.hpp"
+
+// Store of rendered fragments (parts, scores and books), keyed by a hash of
+// the input they were generated from. Fragments are kept in memory and, if a
+// directory is given, on disk. Entries are written atomically, so several
+// processes can share the same directory.
+//
+// Compact caches also render the fragments as compact code, so that they
+// may be written either way.
+class FragmentCache
+{
+public:
+  struct Fragment
+  {
+    // the identifiers the fragment used, to be registered again on reuse
+    IdentifierMap::Entries identifiers;
+    std::string code;
+    std::string compact_code; // empty unless the cache is compact
+  };
+
+  FragmentCache(const std::string &directory = std::string(),
+    bool compact = false);
+
+  bool load(uint64_t key, Fragment *) const;
+  void store(uint64_t key, const Fragment &) const;
+
+  // Sets the code of a fragment to store.
+  void render(const TokenPtr<> &, Fragment *) const;
+
+private:
+  static bool read_entry(const std::string &path, Fragment *);
+
+  uint64_t entry_key(uint64_t key) const;
+  std::string path(uint64_t key) const;
+
+  std::string m_directory;
+  bool m_compact;
+
+  mutable std::mutex m_mutex;
+  mutable std::unordered_map<uint64_t, Fragment> m_fragments;
+};
+
+#endif
@@ -0,0 +1,245 @@
+#include "compile.hpp"
+
+#include <algorithm>
+#include <boost/format.hpp>
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <fcntl.h>
+#include <spawn.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "error.hpp"
+#include "hash.hpp"
+#include "output.hpp"
+#include "parallel.hpp"
+#include "store.hpp"
+
+using namespace std;
+using format = boost::format;
+
+extern char **environ;
+
+const string INCLUDE = "\\include \"";
+
+Compiler::Compiler(const string &executable, const string &directory,
+  const ResultStore *store, const vector<string> &include_paths)
+  : m_executable(executable), m_directory(directory), m_store(store),
+    m_include_paths(include_paths)
+{
+  make_directory(directory);
+}
+
+string Compiler::source_path(const CompileJob &job) const
+{
+  return m_directory + "/" + job.name + ".ly";
+}
+
+string Compiler::log_path(const CompileJob &job) const
+{
+  return m_directory + "/" + job.name + ".log";
+}
+
+vector<CompileResult> Compiler::run(const vector<CompileJob> &jobs,
+  const unsigned int max_jobs) const
+{
+  vector<CompileResult> results(jobs.size());
+  vector<size_t> order(jobs.size());
+
+  for(size_t i = 0; i < order.size(); i++)
+    order[i] = i;
+
+  // biggest jobs first, so that a long book does not start last while the
+  // other workers sit idle
+  stable_sort(order.begin(), order.end(), [&](size_t a, size_t b) {
+    return jobs[a].source.size() > jobs[b].source.size();
+  });
+
+  parallel_for(order.size(), max_jobs, [&](size_t i) {
+    // a job that cannot be written or restored only fails itself
+    try {
+      results[order[i]] = compile(jobs[order[i]]);
+    }
+    catch(const std::exception &err) {
+      results[order[i]] = {-1, 0, false, err.what()};
+    }
+  });
+
+  if(m_store)
+    m_store->evict();
+
+  return results;
+}
+
+// files included by the source, as written by String::write
+static vector<string> includes(const string &source)
+{
+  vector<string> files;
+  size_t pos = 0;
+
+  while((pos = source.find(INCLUDE, pos)) != string::npos) {
+    string file;
+
+    for(pos += INCLUDE.size(); pos < source.size(); pos++) {
+      if(source[pos] == '"')
+        break;
+      else if(source[pos] == '\\' && pos + 1 < source.size())
+        pos++;
+
+      file += source[pos];
+    }
+
+    files.push_back(file);
+  }
+
+  return files;
+}
+
+static uint64_t hash_field(const string &value, uint64_t hash)
+{
+  const uint64_t size = value.size();
+  hash = hash_bytes((const char *)&size, sizeof(size), hash);
+
+  return hash_string(value, hash);
+}
+
+// the file LilyPond reads: next to the including file, else in the include
+// paths, else in the working directory
+string Compiler::resolve(const string &file, const string &dir) const
+{
+  if(!file.empty() && file[0] == '/')
+    return file;
+
+  vector<string> candidates{dir + "/" + file};
+
+  for(const string &path : m_include_paths)
+    candidates.push_back(path + "/" + file);
+
+  for(const string &candidate : candidates) {
+    if(!access(candidate.c_str(), F_OK))
+      return candidate;
+  }
+
+  return file;
+}
+
+void Compiler::hash_includes(const string &code, const string &dir,
+  set<string> *seen, uint64_t *hash) const
+{
+  for(const string &file : includes(code)) {
+    const string path = resolve(file, dir);
+
+    if(!seen->insert(path).second)
+      continue;
+
+    string content;
+    const bool exists = read_file(path, &content);
+
+    *hash = hash_field(path, *hash);
+    *hash = hash_bytes((const char *)&exists, sizeof(exists), *hash);
+    *hash = hash_field(content, *hash);
+
+    if(exists) {
+      const size_t slash = path.rfind('/');
+      const string parent = slash == string::npos ? "." : path.substr(0, slash);
+      hash_includes(content, parent, seen, hash);
+    }
+  }
+}
+
+uint64_t Compiler::key(const CompileJob &job) const
+{
+  uint64_t hash = hash_field(m_executable, HASH_BASIS);
+
+  for(const string &path : m_include_paths)
+    hash = hash_field(path, hash);
+
+  // the source holds the \version, the header, paper and setup
+  hash = hash_field(job.source, hash);
+
+  set<string> seen;
+  hash_includes(job.source, m_directory, &seen, &hash);
+
+  return hash;
+}
+
+CompileResult Compiler::compile(const CompileJob &job) const
+{
+  const auto start = chrono::steady_clock::now();
+
+  write_if_changed(source_path(job), job.source);
+
+  const uint64_t hash = m_store ? key(job) : 0;
+  bool restored = false;
+  int status = 0;
+
+  if(m_store && m_store->restore(hash, m_directory, job.name))
+    restored = true;
+  else {
+    // outputs left by a previous compilation must not be stored with the
+    // new ones
+    const string prefix = job.name + ".";
+
+    for(const string &file : list_directory(m_directory)) {
+      if(file.compare(0, prefix.size(), prefix) == 0 &&
+          file != prefix + "ly")
+        unlink((m_directory + "/" + file).c_str());
+    }
+
+    status = execute(job);
+
+    if(m_store && status == 0)
+      m_store->store(hash, m_directory, job.name);
+  }
+
+  const chrono::duration<double> elapsed =
+    chrono::steady_clock::now() - start;
+
+  return {status, elapsed.count(), restored, ""};
+}
+
+int Compiler::execute(const CompileJob &job) const
+{
+  const string source = source_path(job);
+  const string output = m_directory + "/" + job.name;
+  const string log = log_path(job);
+
+  vector<const char *> argv{m_executable.c_str()};
+
+  for(const string &path : m_include_paths) {
+    argv.push_back("-I");
+    argv.push_back(path.c_str());
+  }
+
+  argv.insert(argv.end(), {"-o", output.c_str(), source.c_str(), nullptr});
+
+  posix_spawn_file_actions_t actions;
+  posix_spawn_file_actions_init(&actions);
+  posix_spawn_file_actions_addopen(&actions, STDOUT_FILENO, log.c_str(),
+    O_WRONLY | O_CREAT | O_TRUNC, 0666);
+  posix_spawn_file_actions_adddup2(&actions, STDOUT_FILENO, STDERR_FILENO);
+
+  pid_t pid;
+  int status = -1;
+
+  if(!posix_spawnp(&pid, argv[0], &actions, nullptr, (char **)argv.data(),
+      environ)) {
+    int wstatus;
+    pid_t waited;
+
+    while((waited = waitpid(pid, &wstatus, 0)) < 0 && errno == EINTR);
+
+    if(waited < 0)
+      status = -1;
+    else if(WIFEXITED(wstatus))
+      status = WEXITSTATUS(wstatus);
+    else if(WIFSIGNALED(wstatus))
+      status = 128 + WTERMSIG(wstatus);
+  }
+
+  posix_spawn_file_actions_destroy(&actions);
+
+  return status;
+}
@@ -0,0 +1,62 @@
+#ifndef COMPILE_HPP
+#define COMPILE_HPP
+
+#include <cstdint>
+#include <set>
+#include <string>
+#include <vector>
+
+class ResultStore;
+
+// A score or a book to be compiled by LilyPond on its own.
+struct CompileJob
+{
+  std::string name; // base name of the files produced
+  std::string source;
+};
+
+struct CompileResult
+{
+  int status; // exit status of the compiler, -1 if it could not be started
+  double seconds;
+  bool restored; // the outputs came from the result store
+  std::string error; // why the job could not be run, if status is -1
+};
+
+// Runs LilyPond (or any program taking the same arguments) on each job, in
+// a directory holding the sources, the outputs and the logs. With a result
+// store, the outputs of a job already compiled are restored instead. The
+// include paths are passed to the compiler with -I.
+class Compiler
+{
+public:
+  Compiler(const std::string &executable, const std::string &directory,
+    const ResultStore *store = nullptr,
+    const std::vector<std::string> &include_paths = {});
+
+  // Compiles the jobs running up to `jobs` compilers at once. The results
+  // are in the same order as the jobs.
+  std::vector<CompileResult> run(const std::vector<CompileJob> &,
+    unsigned int jobs) const;
+
+  std::string source_path(const CompileJob &) const;
+  std::string log_path(const CompileJob &) const;
+
+  // Hash of the source, the files it includes and the compiler.
+  uint64_t key(const CompileJob &) const;
+
+private:
+  std::string resolve(const std::string &file, const std::string &dir) const;
+  void hash_includes(const std::string &code, const std::string &dir,
+    std::set<std::string> *seen, uint64_t *hash) const;
+
+  CompileResult compile(const CompileJob &) const;
+  int execute(const CompileJob &) const;
+
+  std::string m_executable;
+  std::string m_directory;
+  const ResultStore *m_store;
+  std::vector<std::string> m_include_paths;
+};
+
+#endif
@@ -0,0 +1,39 @@
+#include "context.hpp"
+
+#include <cstdint>
+#include <cstring>
+
+using namespace std;
+
+Context::Context(const bool use_arena, const IdentifierMap *base)
+  : m_identifiers(base), m_arena(use_arena ? new Arena : nullptr)
+{
+}
+
+void Context::add_key(string &key, const string &value)
+{
+  key += '\0';
+  key += to_string(value.size());
+  key += ':';
+  key += value;
+}
+
+void Context::add_key(string &key, const char *value)
+{
+  key += '\0';
+  key += to_string(strlen(value));
+  key += ':';
+  key += value;
+}
+
+void Context::add_key(string &key, const long long value)
+{
+  key += '\0';
+  key += to_string(value);
+}
+
+void Context::add_key(string &key, const Token *token)
+{
+  key += '\0';
+  key += to_string(reinterpret_cast<uintptr_t>(token));
+}
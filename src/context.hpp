@@ -0,0 +1,95 @@
+#ifndef CONTEXT_HPP
+#define CONTEXT_HPP
+
+#include <initializer_list>
+#include <memory>
+#include <string>
+#include <typeinfo>
+#include <unordered_map>
+#include <utility>
+
+#include "arena.hpp"
+#include "identifiers.hpp"
+
+// State shared by the generators of a single document. Documents built with
+// separate contexts are independent and can be generated concurrently.
+class Context
+{
+public:
+  Context(bool use_arena = false, const IdentifierMap *base = nullptr);
+
+  IdentifierMap &identifiers() { return m_identifiers; }
+  Arena *arena() const { return m_arena.get(); }
+
+  template <class T, class... Args>
+  TokenPtr<T> make(Args &&... args)
+  {
+    if(m_arena)
+      return m_arena->make<T>(std::forward<Args>(args)...);
+    else
+      return std::make_shared<T>(std::forward<Args>(args)...);
+  }
+
+  // Returns the instance shared by every T built from the same arguments,
+  // creating it on first use. Interned tokens may have several parents and
+  // must never be modified.
+  template <class T, class... Args>
+  TokenPtr<T> intern(const Args &... args)
+  {
+    return intern_node<T>({}, args...);
+  }
+
+  // Same for a token having children, which must be interned themselves.
+  template <class T, class... Args>
+  TokenPtr<T> intern_node(std::initializer_list<TokenPtr<> > children,
+    const Args &... args)
+  {
+    // reusing the key buffer saves an allocation per lookup
+    std::string &key = m_key;
+    key = typeid(T).name();
+    append_key(key, args...);
+
+    for(const TokenPtr<> &child : children)
+      add_key(key, child.get());
+
+    const auto it = m_interned.find(key);
+
+    if(it != m_interned.end())
+      return std::static_pointer_cast<T>(it->second);
+
+    const TokenPtr<T> token = make<T>(args...);
+
+    for(const TokenPtr<> &child : children)
+      *token << child;
+
+    token->set_shared();
+    m_interned.emplace(key, token);
+
+    return token;
+  }
+
+  size_t interned() const { return m_interned.size(); }
+
+private:
+  static void add_key(std::string &, const std::string &);
+  static void add_key(std::string &, const char *);
+  static void add_key(std::string &, long long);
+  static void add_key(std::string &, const Token *);
+
+  static void append_key(std::string &) {}
+
+  template <class First, class... Rest>
+  static void append_key(std::string &key, const First &first,
+    const Rest &... rest)
+  {
+    add_key(key, first);
+    append_key(key, rest...);
+  }
+
+  IdentifierMap m_identifiers;
+  std::unique_ptr<Arena> m_arena;
+  std::unordered_map<std::string, TokenPtr<> > m_interned;
+  std::string m_key;
+};
+
+#endif
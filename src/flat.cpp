@@ -0,0 +1,188 @@
+#include "flat.hpp"
+
+#include <sstream>
+
+#include "error.hpp"
+
+using namespace std;
+
+FlatTree::FlatTree(const TokenPtr<> &root)
+{
+  // the tokens of the nodes laid out so far, to visit breadth-first
+  vector<const Token *> tokens{root.get()};
+  m_nodes.push_back(Node());
+
+  for(size_t i = 0; i < tokens.size(); i++) {
+    const Token *token = tokens[i];
+    const Token::Shape shape = token->shape();
+
+    Node node;
+    node.kind = shape.kind;
+    node.flags = (token->empty() ? EMPTY : 0) | (shape.flag ? VALUE : 0);
+    node.text = m_text.size();
+    node.text_size = 0;
+    node.first = tokens.size();
+    node.count = 0;
+
+    if(shape.kind == Token::ForeignKind) {
+      node.text = m_foreign.size();
+      m_foreign.push_back(token);
+    }
+    else if(shape.value) {
+      tokens.push_back(shape.value->get());
+      node.count = 1;
+    }
+    else {
+      for(const TokenPtr<> &child : token->m_children)
+        tokens.push_back(child.get());
+
+      node.count = token->m_children.size();
+    }
+
+    if(shape.text) {
+      // the offsets of the texts are 32 bits wide too
+      if(shape.text->size() > UINT32_MAX - m_text.size())
+        throw Error("too much text to lay out");
+
+      m_text += *shape.text;
+      node.text_size = shape.text->size();
+    }
+
+    if(tokens.size() > UINT32_MAX)
+      throw Error("too many tokens to lay out");
+
+    m_nodes[i] = node;
+    m_nodes.resize(tokens.size());
+  }
+}
+
+string FlatTree::code() const
+{
+  ostringstream stream;
+  write(stream);
+  return stream.str();
+}
+
+void FlatTree::write(ostream &stream, const unsigned int level) const
+{
+  write_node(stream, 0, level, is_compact(stream));
+}
+
+bool FlatTree::omitted(const uint32_t index, const bool compact) const
+{
+  const Node &node = m_nodes[index];
+  return node.flags & EMPTY || (compact && node.kind == Token::CommentKind);
+}
+
+void FlatTree::write_node(ostream &stream, const uint32_t index,
+  const unsigned int level, const bool compact) const
+{
+  const Node &node = m_nodes[index];
+  const char *text = m_text.data() + node.text;
+  const uint32_t end = node.first + node.count;
+
+  switch(node.kind) {
+  case Token::SequenceKind:
+    for(uint32_t i = node.first; i < end; i++) {
+      if(omitted(i, compact))
+        continue;
+
+      write_node(stream, i, level, compact);
+
+      if(compact) {
+        stream.put('\n');
+        continue;
+      }
+
+      Token::newline(stream, level);
+
+      if(i + 1 != end)
+        Token::newline(stream, level);
+    }
+    break;
+  case Token::CommandKind:
+    stream.put('\\');
+    stream.write(text, node.text_size);
+
+    for(uint32_t i = node.first; i < end; i++) {
+      if(omitted(i, compact))
+        continue;
+
+      stream.put(' ');
+      write_node(stream, i, level, compact);
+    }
+    break;
+  case Token::BraceBlockKind:
+  case Token::BracketBlockKind: {
+    const bool brace = node.kind == Token::BraceBlockKind;
+    stream << (brace ? "{" : "<<");
+
+    bool has_content = false;
+
+    for(uint32_t i = node.first; i < end; i++) {
+      if(omitted(i, compact))
+        continue;
+
+      if(compact) {
+        stream.put(' ');
+        write_node(stream, i, level + 1, compact);
+        has_content = true;
+        continue;
+      }
+
+      if(!has_content) {
+        Token::newline(stream, level);
+        has_content = true;
+      }
+
+      stream << "  ";
+      write_node(stream, i, level + 1, compact);
+      Token::newline(stream, level);
+    }
+
+    if(compact && has_content)
+      stream.put(' ');
+
+    stream << (brace ? "}" : ">>");
+    break;
+  }
+  case Token::VariableKind:
+    stream.write(text, node.text_size);
+    stream << " = ";
+    write_node(stream, node.first, level, compact);
+    break;
+  case Token::BooleanKind:
+    stream << (node.flags & VALUE ? "##t" : "##f");
+    break;
+  case Token::StringKind:
+    Token::write_string(stream, text, node.text_size, level);
+    break;
+  case Token::LiteralKind:
+    Token::write_text(stream, text, node.text_size, level);
+    break;
+  case Token::FunctionKind:
+    stream << "#(";
+    stream.write(text, node.text_size);
+
+    for(uint32_t i = node.first; i < end; i++) {
+      stream.put(' ');
+      write_node(stream, i, level, compact);
+    }
+
+    stream << ")";
+    break;
+  case Token::CommentKind:
+    Token::write_comment(stream, text, node.text_size, node.flags & VALUE,
+      level);
+    break;
+  case Token::ForeignKind:
+    m_foreign[node.text]->write(stream, level);
+    break;
+  }
+}
+
+ostream &operator<<(ostream &stream, const FlatTree &tree)
+{
+  tree.write(stream);
+  return stream;
+}
@@ -0,0 +1,55 @@
+#ifndef FLAT_HPP
+#define FLAT_HPP
+
+#include <cstdint>
+#include <ostream>
+#include <string>
+#include <vector>
+
+#include "tokens.hpp"
+
+// Read-only copy of a token tree laid out for writing. The nodes are stored
+// breadth-first in a single array, so the children of a node are contiguous,
+// and their names and texts share one buffer. Writing dispatches on the kind
+// of the nodes instead of calling virtual functions.
+//
+// Tokens of classes unknown to the flat tree are written through their own
+// write() function: the tree must not outlive them.
+//
+// The output is still written from the tokens themselves, the flat tree is
+// only measured by the benchmark so far.
+class FlatTree
+{
+public:
+  FlatTree(const TokenPtr<> &root);
+
+  std::string code() const;
+  void write(std::ostream &, unsigned int level = 0) const;
+
+  size_t size() const { return m_nodes.size(); }
+
+private:
+  enum Flag : uint8_t { EMPTY = 1 << 0, VALUE = 1 << 1 };
+
+  struct Node
+  {
+    uint8_t kind;
+    uint8_t flags;
+    uint32_t text;
+    uint32_t text_size;
+    uint32_t first;
+    uint32_t count;
+  };
+
+  bool omitted(uint32_t index, bool compact) const;
+  void write_node(std::ostream &, uint32_t index, unsigned int level,
+    bool compact) const;
+
+  std::vector<Node> m_nodes;
+  std::string m_text;
+  std::vector<const Token *> m_foreign;
+};
+
+std::ostream &operator<<(std::ostream &, const FlatTree &);
+
+#endif
@@ -1,91 +1,104 @@
 #include "generators.hpp"
 
+#include <algorithm>
 #include <boost/format.hpp>
-#include <random>
-#include <unordered_set>
 #include <yaml-cpp/yaml.h>
 
 #include "error.hpp"
+#include "hash.hpp"
+#include "scalar.hpp"
 
 using namespace std;
 using format = boost::format;
 
 const string LILY_VERSION = "2.18.2";
 
-enum DocumentKey { D_VERSION, D_HEADER, D_PAPER, D_SETUP,
-  D_PARTS, D_BOOK, D_SCORE , D_GSTAFF_SIZE };
-
-const map<string, DocumentKey> DOCUMENT_KEYS = {
-  {"version", D_VERSION},
-  {"header", D_HEADER},
-  {"paper", D_PAPER},
-  {"setup", D_SETUP},
-  {"parts", D_PARTS},
-  {"book", D_BOOK},
-  {"score", D_SCORE},
-  {"global-staff-size", D_GSTAFF_SIZE},
-};
+// The key tables are switches on the hash of the key, checked against the
+// expected string. The compiler rejects duplicate case labels, so a hash
+// collision between two keys cannot go unnoticed.
+DocumentKey document_key(const string &key)
+{
+  const char *name;
+  DocumentKey type;
+
+  switch(hash_string(key)) {
+  case hash_literal("version"):
+    name = "version", type = D_VERSION;
+    break;
+  case hash_literal("header"):
+    name = "header", type = D_HEADER;
+    break;
+  case hash_literal("paper"):
+    name = "paper", type = D_PAPER;
+    break;
+  case hash_literal("setup"):
+    name = "setup", type = D_SETUP;
+    break;
+  case hash_literal("parts"):
+    name = "parts", type = D_PARTS;
+    break;
+  case hash_literal("book"):
+    name = "book", type = D_BOOK;
+    break;
+  case hash_literal("score"):
+    name = "score", type = D_SCORE;
+    break;
+  case hash_literal("global-staff-size"):
+    name = "global-staff-size", type = D_GSTAFF_SIZE;
+    break;
+  default:
+    return D_INVALID;
+  }
 
-const unordered_set<string> KEY_COMMANDS = { "key", "time", "tempo" };
+  return key == name ? type : D_INVALID;
+}
 
-const int ID_LENGTH = 8;
-IdentifierMap Generator::s_identifiers;
+static bool is_key_command(const string &key)
+{
+  switch(hash_string(key)) {
+  case hash_literal("key"):
+    return key == "key";
+  case hash_literal("time"):
+    return key == "time";
+  case hash_literal("tempo"):
+    return key == "tempo";
+  default:
+    return false;
+  }
+}
 
 TokenPtr<> Generator::make_variable(const std::string &key,
-  const YAML::Node &node) const
+  const std::string &value) const
 {
   // TODO: support setting hashes values
-  return make_shared<Variable>(key, make_value(node));
+  return make<Variable>(key, make_value(value));
 }
 
-TokenPtr<> Generator::make_value(const YAML::Node &node) const
+TokenPtr<> Generator::make_value(const std::string &value) const
 {
-  assert(node.IsScalar());
-
-  const string value = node.Scalar();
-
-  try {
-    return make_shared<Boolean>(node.as<bool>());
-  }
-  catch(YAML::BadConversion) {}
-
-  try {
-    if(value.find('\\') != string::npos ||
-        value.find('#') == 0 || node.as<double>())
-      return make_shared<Literal>(value);
+  bool boolean;
+
+  switch(classify_scalar(value, &boolean)) {
+  case BooleanScalar:
+    return make<Boolean>(boolean);
+  case LiteralScalar:
+    return make<Literal>(value);
+  case StringScalar:
+    break;
   }
-  catch(YAML::BadConversion) {}
 
-  return make_shared<String>(value);
+  return make<String>(value);
 }
 
 string Generator::id(const std::string &name) const
 {
-  if(s_identifiers.left.count(name))
-    return s_identifiers.left.at(name);
-
-  std::random_device rd;
-  std::default_random_engine engine(rd());
-  std::uniform_int_distribution<char> rand('a', 'z');
-
-  string random_str;
-  while(random_str.size() < ID_LENGTH || s_identifiers.right.count(random_str))
-    random_str.push_back(rand(engine));
-
-  string alphaName = name;
-  alphaName.erase(remove_if(alphaName.begin(), alphaName.end(),
-    [](const char c) { return !isalnum(c); }), alphaName.end());
-
-  const string identifier = "pm_" + random_str + "_" + alphaName;
-
-  s_identifiers.insert({name, identifier});
-
-  return identifier;
+  return m_context.identifiers().get(name);
 }
 
-KeyValue::KeyValue()
+KeyValue::KeyValue(Context &context)
+  : Generator(context)
 {
-  m_token = make_shared<Block>(Block::BraceStyle);
+  m_token = make<Block>(Block::BraceStyle);
 }
 
 void KeyValue::read_yaml(const YAML::Node &root)
@@ -93,99 +106,109 @@ void KeyValue::read_yaml(const YAML::Node &root)
   if(!root.IsMap())
     throw Error("keyvalue block must be a map");
 
-  for(auto it = root.begin(); it != root.end(); it++) {
-    const string key = it->first.as<string>();
-    const YAML::Node node = it->second;
-
-    bool append = true;
-
-    for(const SpecialHandler &h : m_handlers)
-      if(!(append = append && h(key, node))) break;
+  for(auto it = root.begin(); it != root.end(); it++)
+    add(it->first.as<string>(), it->second.as<string>());
+}
 
-    if(!append) continue;
+void KeyValue::add(const std::string &key, const std::string &value)
+{
+  for(const SpecialHandler &h : m_handlers)
+    if(!h(key, value)) return;
 
-    if(KEY_COMMANDS.count(key)) {
-      auto command = make_shared<Command>(key);
-      *command << make_shared<Literal>(node.as<string>());
-      *m_token << command;
-    }
-    else
-      *m_token << make_variable(key, node);
+  if(is_key_command(key)) {
+    auto command = make<Command>(key);
+    *command << make<Literal>(value);
+    *m_token << std::move(command);
   }
+  else
+    *m_token << make_variable(key, value);
 }
 
-enum PartKey { P_NAME, P_TYPE, P_RELATIVE, P_INSTRUMENT, P_PARTS, P_PREFIX };
-
-const map<string, PartKey> PART_KEYS = {
-  {"name", P_NAME},
-  {"type", P_TYPE},
-  {"relative", P_RELATIVE},
-  {"instrument", P_INSTRUMENT},
-  {"parts", P_PARTS},
-  {"prefix", P_PREFIX},
-};
-
-Part Part::from_yaml(const std::string &name, const YAML::Node &node)
+PartKey part_key(const string &key)
 {
-  Part part(name);
-  part.read_yaml(node);
-  return part;
+  const char *name;
+  PartKey type;
+
+  switch(hash_string(key)) {
+  case hash_literal("name"):
+    name = "name", type = P_NAME;
+    break;
+  case hash_literal("type"):
+    name = "type", type = P_TYPE;
+    break;
+  case hash_literal("relative"):
+    name = "relative", type = P_RELATIVE;
+    break;
+  case hash_literal("instrument"):
+    name = "instrument", type = P_INSTRUMENT;
+    break;
+  case hash_literal("parts"):
+    name = "parts", type = P_PARTS;
+    break;
+  case hash_literal("prefix"):
+    name = "prefix", type = P_PREFIX;
+    break;
+  default:
+    return P_INVALID;
+  }
+
+  return key == name ? type : P_INVALID;
 }
 
-Part::Part(const std::string &name)
-  : m_name(name), m_part_prefix(true)
+Part::Part(const std::string &name, Context &context)
+  : Generator(context), m_name(name), m_part_prefix(true)
 {
   m_id = id(name);
 
-  m_type = make_shared<Literal>("Staff");
-  m_staff = make_shared<Command>("new");
+  m_type = make<Literal>("Staff");
+  m_staff = make<Command>("new");
   *m_staff << m_type;
-  *m_staff << make_shared<Literal>("=");
-  *m_staff << make_shared<String>(name);
+  *m_staff << intern<Literal>("=");
+  *m_staff << make<String>(name);
 
   prepare_with();
 
-  m_staff_block = make_shared<Block>(Block::BracketStyle);
+  m_staff_block = make<Block>(Block::BracketStyle);
   *m_staff << m_staff_block;
 
-  m_token = make_shared<Variable>(m_id, m_staff);
+  m_token = make<Variable>(m_id, m_staff);
 
   prepare_music();
 }
 
 void Part::prepare_with()
 {
-  m_long_name = make_shared<String>("");
-  m_short_name = make_shared<String>();
-  m_instrument = make_shared<String>();
+  m_long_name = make<String>("");
+  m_short_name = make<String>();
+  m_instrument = make<String>();
 
-  auto no_performer = make_shared<Command>("remove");
-  *no_performer << make_shared<String>("Staff_performer");
+  const auto performer = intern<String>("Staff_performer");
+  const auto no_performer = intern_node<Command>({performer}, "remove");
 
-  m_performer = make_shared<Command>("");
-  *m_performer << make_shared<String>("Staff_performer");
+  m_performer = make<Command>("");
+  *m_performer << performer;
 
-  auto block = make_shared<Block>(Block::BraceStyle);
-  *block << make_shared<Variable>("instrumentName", m_long_name);
-  *block << make_shared<Variable>("shortInstrumentName", m_short_name);
-  *block << make_shared<Variable>("midiInstrument", m_instrument);
+  auto block = make<Block>(Block::BraceStyle);
+  *block << make<Variable>("instrumentName", m_long_name);
+  *block << make<Variable>("shortInstrumentName", m_short_name);
+  *block << make<Variable>("midiInstrument", m_instrument);
   *block << no_performer;
   *block << m_performer;
 
-  auto with = make_shared<Command>("with");
-  *with << block;
+  auto with = make<Command>("with");
+  *with << std::move(block);
 
-  *m_staff << with;
+  *m_staff << std::move(with);
 }
 
 void Part::prepare_music()
 {
-  auto include = make_shared<Command>("include");
-  *include << make_shared<String>("parts/" + m_name + ".ily");
+  auto include = make<Command>("include");
+  *include << make<String>("parts/" + m_name + ".ily");
 
-  m_music_block = make_shared<Block>(Block::BraceStyle);
-  *m_music_block << make_shared<Command>(id("setup"));
-  *m_music_block << include;
+  m_music_block = make<Block>(Block::BraceStyle);
+  *m_music_block << intern<Command>(id("setup"));
+  *m_music_block << std::move(include);
 }
 
 void Part::read_yaml(const YAML::Node &root)
@@ -194,46 +217,75 @@ void Part::read_yaml(const YAML::Node &root)
     const string key = it->first.as<string>();
     const YAML::Node node = it->second;
 
-    if(!PART_KEYS.count(key))
-      throw Error(format("invalid key '%s'") % key);
-
-    const PartKey type = PART_KEYS.at(key);
+    const PartKey type = part_key(key);
 
     switch(type) {
+      case P_INVALID:
+        throw Error(format("invalid key '%s'") % key);
       case P_NAME:
-        set_names(node);
+        read_names(node);
         break;
       case P_TYPE:
-        *m_type = node.as<string>();
-
-        if(m_type->get() == "DrumStaff") {
-          auto relative = make_shared<Command>("drummode");
-          *relative << m_music_block;
-          *m_staff_block << relative;
-        }
+        set_type(node.as<string>());
         break;
-      case P_RELATIVE: {
-        auto relative = make_shared<Command>("relative");
-        *relative << make_shared<Literal>(node.as<string>());
-        *relative << m_music_block;
-        *m_staff_block << relative;
+      case P_RELATIVE:
+        set_relative(node.as<string>());
         break;
-      }
       case P_INSTRUMENT:
-        *m_instrument = node.as<string>();
-        *m_performer = "consists";
+        set_instrument(node.as<string>());
         break;
       case P_PARTS:
         add_sub_parts(node);
         break;
       case P_PREFIX:
-        m_part_prefix = node.as<bool>();
+        set_prefix(node.as<bool>());
         break;
     }
   }
 }
 
-void Part::set_names(const YAML::Node &node)
+void Part::set_names(const std::string &long_name,
+  const std::string &short_name)
+{
+  *m_long_name = long_name;
+  *m_short_name = short_name;
+}
+
+void Part::set_type(const std::string &type)
+{
+  *m_type = type;
+
+  if(m_type->get() == "DrumStaff") {
+    auto relative = make<Command>("drummode");
+    *relative << m_music_block;
+    *m_staff_block << std::move(relative);
+  }
+}
+
+void Part::set_relative(const std::string &pitch)
+{
+  auto relative = make<Command>("relative");
+  *relative << intern<Literal>(pitch);
+  *relative << m_music_block;
+  *m_staff_block << std::move(relative);
+}
+
+void Part::set_instrument(const std::string &instrument)
+{
+  *m_instrument = instrument;
+  *m_performer = "consists";
+}
+
+Part Part::add_sub_part(const std::string &key)
+{
+  const string name = m_part_prefix ? m_name + "_" + key : key;
+  const Part sub(name, m_context);
+  *m_staff_block << sub.staff();
+
+  return sub;
+}
+
+void Part::read_names(const YAML::Node &node)
 {
   if(node.IsSequence()) {
     vector<string> names = node.as<vector<string> >();
@@ -245,49 +297,191 @@ void Part::set_names(const YAML::Node &node)
 
     names.resize(2);
 
-    *m_long_name = names[0];
-    *m_short_name = names[1];
+    set_names(names[0], names[1]);
   }
   else {
     const string name = node.as<string>();
-    *m_long_name = name;
-    *m_short_name = name;
+    set_names(name, name);
   }
 }
 
 void Part::add_sub_parts(const YAML::Node &root)
 {
-  for(auto it = root.begin(); it != root.end(); it++) {
-    const string key = it->first.as<string>();
-    const YAML::Node node = it->second;
+  for(auto it = root.begin(); it != root.end(); it++)
+    add_sub_part(it->first.as<string>()).read_yaml(it->second);
+}
+
+Score::Score(Context &context)
+  : Generator(context), m_part_refs(make_shared<vector<string> >()),
+    m_layout_block(context), m_midi_block(context), m_header_block(context)
+{
+  m_blocks.push_back(make<Block>(Block::BracketStyle));
+
+  // the optional blocks are disabled until they get a name
+  m_layout = make<Command>("");
+  *m_layout << m_layout_block.token();
+
+  m_midi = make<Command>("");
+  *m_midi << m_midi_block.token();
+
+  m_header = make<Command>("");
+  *m_header << m_header_block.token();
 
-    const string name = m_part_prefix ? m_name + "_" + key : key;
-    const Part sub = Part::from_yaml(name, node);
-    *m_staff_block << sub.staff();
+  auto score_block = make<Block>(Block::BraceStyle);
+  *score_block << m_blocks.front() << m_layout << m_midi << m_header;
+
+  auto score = make<Command>("score");
+  *score << std::move(score_block);
+
+  m_token = std::move(score);
+}
+
+void Score::read_yaml(const YAML::Node &root)
+{
+  if(!root["parts"].IsSequence())
+    throw Error("score.parts must be an array");
+
+  for(auto it = root["parts"].begin(); it != root["parts"].end(); it++)
+    read_part_ref(*it);
+
+  if(root["layout"]) {
+    KeyValue &block = layout();
+
+    if(root["layout"].IsMap())
+      block.read_yaml(root["layout"]);
+  }
+
+  if(root["midi"]) {
+    KeyValue &block = midi();
+
+    if(root["midi"].IsMap())
+      block.read_yaml(root["midi"]);
+  }
+
+  if(root["header"]) {
+    KeyValue &block = header();
+
+    if(root["header"].IsMap())
+      block.read_yaml(root["header"]);
+  }
+}
+
+void Score::read_part_ref(const YAML::Node &node)
+{
+  if(node.IsSequence()) {
+    begin_group();
+
+    for(auto it = node.begin(); it != node.end(); it++)
+      read_part_ref(*it);
+
+    end_group();
   }
+  else
+    add_part_ref(node.as<string>());
+}
+
+void Score::add_part_ref(const std::string &name)
+{
+  *m_blocks.back() << intern<Command>(id(name));
+  m_part_refs->push_back(name);
+}
+
+void Score::begin_group()
+{
+  auto block = make<Block>(Block::BracketStyle);
+
+  auto group = make<Command>("new");
+  *group << intern<Literal>("StaffGroup");
+  *group << block;
+
+  *m_blocks.back() << std::move(group);
+  m_blocks.push_back(block);
+}
+
+void Score::end_group()
+{
+  if(m_blocks.size() < 2)
+    throw Error("no staff group to end");
+
+  m_blocks.pop_back();
+}
+
+KeyValue &Score::layout()
+{
+  *m_layout = "layout";
+  return m_layout_block;
+}
+
+KeyValue &Score::midi()
+{
+  *m_midi = "midi";
+  return m_midi_block;
+}
+
+KeyValue &Score::header()
+{
+  *m_header = "header";
+  return m_header_block;
+}
+
+void Score::set_midi_only()
+{
+  *m_layout = "";
+  midi();
+}
+
+Book::Book(Context &context)
+  : Generator(context), m_scores(make_shared<vector<Score> >())
+{
+  m_block = make<Block>(Block::BraceStyle);
+
+  auto book = make<Command>("book");
+  *book << m_block;
+
+  m_token = std::move(book);
+}
+
+void Book::read_yaml(const YAML::Node &node)
+{
+  if(!node.IsSequence())
+    throw Error("a book must be an array of scores");
+
+  for(auto it = node.begin(); it != node.end(); it++)
+    add_score().read_yaml(*it);
+}
+
+Score Book::add_score()
+{
+  const Score score(m_context);
+  *m_block << score.token();
+  m_scores->push_back(score);
+
+  return score;
 }
 
-Document::Document()
+Document::Document(const bool use_arena)
+  : Generator(m_own_context), m_own_context(use_arena),
+    m_header(m_context), m_paper(m_context), m_setup(m_context)
 {
-  m_token = make_shared<Token>();
-  m_version = make_shared<String>(LILY_VERSION);
+  m_token = make<Token>();
+  m_version = make<String>(LILY_VERSION);
 
-  auto warning = make_shared<Comment>(
+  auto warning = make<Comment>(
     "WARNING: THIS FILE WAS GENERATED BY PARTMAN\n"
     "========== DO NOT EDIT MANUALLY! ==========\n"
     "ALL CHANGES MADE IN THIS FILE WILL BE LOST!"
   , true);
 
-  auto version = make_shared<Command>("version");
+  auto version = make<Command>("version");
   *version << m_version;
 
-  auto point_click = make_shared<Command>("pointAndClickOff");
+  auto point_click = make<Command>("pointAndClickOff");
 
-  *m_token
-    << warning
-    << version
-    << point_click
-  ;
+  m_preamble = {warning, version};
+
+  add_definition(warning);
+  add_definition(version);
+  add_definition(point_click);
 
   prepare_header();
   prepare_paper();
@@ -296,50 +490,50 @@ Document::Document()
 
 void Document::prepare_header()
 {
-  auto tagline = make_shared<Variable>("tagline", make_shared<Boolean>(false));
+  auto tagline = make<Variable>("tagline", make<Boolean>(false));
   *m_header.token() << tagline;
 
-  m_header.add_handler([=](const string &key, const YAML::Node &node) {
+  m_header.add_handler([=](const string &key, const string &value) {
     if(key == "tagline") {
-      *tagline = make_value(node);
+      *tagline = make_value(value);
       return false;
     }
 
     return true;
   });
 
-  auto header_cmd = make_shared<Command>("header");
+  auto header_cmd = make<Command>("header");
   *header_cmd << m_header.token();
-  *m_token << header_cmd;
+  add_definition(header_cmd);
 }
 
 void Document::prepare_paper()
 {
-  auto paper_size = make_shared<String>("letter");
-  auto ps_func = make_shared<Function>("set-paper-size");
+  auto paper_size = make<String>("letter");
+  auto ps_func = make<Function>("set-paper-size");
   *ps_func << paper_size;
   *m_paper.token() << ps_func;
 
-  m_paper.add_handler([=](const string &key, const YAML::Node &node) {
+  m_paper.add_handler([=](const string &key, const string &value) {
     if(key == "paper-size") {
-      *paper_size = node.as<string>();
+      *paper_size = value;
       return false;
     }
 
     return true;
   });
 
-  auto paper_cmd = make_shared<Command>("paper");
+  auto paper_cmd = make<Command>("paper");
   *paper_cmd << m_paper.token();
-  *m_token << paper_cmd;
+  add_definition(paper_cmd);
 }
 
 void Document::prepare_setup()
 {
-  *m_setup.token() << make_shared<Command>("compressFullBarRests");
+  *m_setup.token() << make<Command>("compressFullBarRests");
 
-  auto setup = make_shared<Variable>(id("setup"), m_setup.token());
-  *m_token << setup;
+  auto setup = make<Variable>(id("setup"), m_setup.token());
+  add_definition(setup);
 }
 
 void Document::read_yaml(const YAML::Node &root)
@@ -347,15 +541,14 @@ void Document::read_yaml(const YAML::Node &root)
   for(auto it = root.begin(); it != root.end(); it++) {
     const string key = it->first.as<string>();
     const YAML::Node node = it->second;
-    
-    if(!DOCUMENT_KEYS.count(key))
-      throw Error(format("invalid key '%s'") % key);
 
-    const DocumentKey type = DOCUMENT_KEYS.at(key);
+    const DocumentKey type = document_key(key);
 
     switch(type) {
+    case D_INVALID:
+      throw Error(format("invalid key '%s'") % key);
     case D_VERSION:
-      *m_version = node.as<string>();
+      set_version(node.as<string>());
       break;
     case D_HEADER:
       m_header.read_yaml(node);
@@ -370,112 +563,272 @@ void Document::read_yaml(const YAML::Node &root)
       add_parts(node);
       break;
     case D_BOOK:
-      *m_token << make_book(node);
+      add_book().read_yaml(node);
       break;
     case D_SCORE:
-      *m_token << make_score(node);
+      add_score().read_yaml(node);
       break;
     case D_GSTAFF_SIZE:
-      auto func = make_shared<Function>("set-global-staff-size");
-      *func << make_value(node);
-      *m_token << func;
+      set_global_staff_size(node.as<string>());
       break;
     }
   }
 }
 
+void Document::set_version(const std::string &version)
+{
+  *m_version = version;
+}
+
+void Document::set_global_staff_size(const std::string &size)
+{
+  auto func = make<Function>("set-global-staff-size");
+  *func << make_value(size);
+  add_definition(func);
+}
+
 void Document::add_parts(const YAML::Node &root)
 {
-  for(auto it = root.begin(); it != root.end(); it++) {
-    const string key = it->first.as<string>();
-    const YAML::Node node = it->second;
+  for(auto it = root.begin(); it != root.end(); it++)
+    add_part(it->first.as<string>()).read_yaml(it->second);
+}
 
-    *m_token << Part::from_yaml(key, node).token();
-  }
+Part Document::add_part(const std::string &name)
+{
+  const Part part(name, m_context);
+  add_definition(part.token());
+  m_parts.emplace_back(name, part.token());
+
+  return part;
 }
 
-TokenPtr<> Document::make_score(const YAML::Node &root) const
+Score Document::add_score()
 {
-  if(!root["parts"].IsSequence())
-    throw Error("score.parts must be an array");
+  const Score score(m_context);
+  add_unit({ScoreUnit, score.token(),
+    make_shared<vector<Score> >(1, score), {}});
 
-  auto music_block = make_shared<Block>(Block::BracketStyle);
+  return score;
+}
 
-  for(auto it = root["parts"].begin(); it != root["parts"].end(); it++)
-    *music_block << make_part_ref(*it);
+Book Document::add_book()
+{
+  const Book book(m_context);
+  add_unit({BookUnit, book.token(),
+    book.scores(), {}});
 
-  auto score_block = make_shared<Block>(Block::BraceStyle);
-  *score_block << music_block;
+  return book;
+}
 
-  if(root["layout"]) {
-    KeyValue block;
+void Document::add_part_token(const std::string &name,
+  const TokenPtr<> &token)
+{
+  add_definition(token);
+  m_parts.emplace_back(name, token);
+}
 
-    if(root["layout"].IsMap())
-      block.read_yaml(root["layout"]);
+TokenPtr<> Document::make_code(const std::string &code,
+  const std::string &compact_code) const
+{
+  if(compact_code.empty())
+    return make<Literal>(code);
+
+  return make<RenderedCode>(code, compact_code);
+}
+
+void Document::add_part_code(const std::string &name, const std::string &code,
+  const std::string &compact_code)
+{
+  add_part_token(name, make_code(code, compact_code));
+}
+
+Context &Document::add_context()
+{
+  m_contexts.emplace_back(new Context(m_context.arena() != nullptr,
+    &m_context.identifiers()));
+
+  return *m_contexts.back();
+}
+
+void Document::add_unit_code(const UnitType type, const std::string &code,
+  const std::string &compact_code, const vector<string> &part_refs)
+{
+  add_unit({type, make_code(code, compact_code), nullptr, part_refs});
+}
+
+vector<string> Document::part_refs(const Unit &unit) const
+{
+  if(!unit.scores)
+    return unit.part_refs;
 
-    auto layout = make_shared<Command>("layout");
-    *layout << block.token();
-    *score_block << layout;
+  vector<string> refs;
+
+  for(const Score &score : *unit.scores) {
+    for(const string &name : score.part_refs()) {
+      if(find(refs.begin(), refs.end(), name) == refs.end())
+        refs.push_back(name);
+    }
   }
 
-  if(root["midi"]) {
-    KeyValue block;
+  return refs;
+}
 
-    if(root["midi"].IsMap())
-      block.read_yaml(root["midi"]);
+void Document::preview_unit(const size_t index)
+{
+  const Unit unit = m_units.at(index);
+
+  if(!unit.scores)
+    throw Error("cannot preview a score inserted as code");
 
-    auto midi = make_shared<Command>("midi");
-    *midi << block.token();
-    *score_block << midi;
+  for(Score score : *unit.scores)
+    score.set_midi_only();
+
+  set<TokenPtr<> > others;
+
+  for(const Unit &other : m_units) {
+    if(other.token != unit.token)
+      others.insert(other.token);
   }
 
-  if(root["header"]) {
-    KeyValue block;
+  remove(others);
 
-    if(root["header"].IsMap())
-      block.read_yaml(root["header"]);
+  const vector<string> refs = part_refs(unit);
+  keep_parts(set<string>(refs.begin(), refs.end()));
+}
 
-    auto header = make_shared<Command>("header");
-    *header << block.token();
-    *score_block << header;
+void Document::preview_parts(const vector<string> &names)
+{
+  for(const string &name : names) {
+    if(find_if(m_parts.begin(), m_parts.end(),
+        [&](const pair<string, TokenPtr<> > &part) {
+          return part.first == name;
+        }) == m_parts.end())
+      throw Error(format("unknown part '%s'") % name);
   }
 
-  auto score = make_shared<Command>("score");
-  *score << score_block;
+  set<TokenPtr<> > units;
 
-  return score;
+  for(const Unit &unit : m_units)
+    units.insert(unit.token);
+
+  remove(units);
+
+  Score score = add_score();
+
+  for(const string &name : names)
+    score.add_part_ref(name);
+
+  score.set_midi_only();
+
+  keep_parts(set<string>(names.begin(), names.end()));
 }
 
-TokenPtr<> Document::make_part_ref(const YAML::Node &node) const
+TokenPtr<> Document::unit_token(const size_t index) const
 {
-  if(node.IsSequence()) {
-    auto block = make_shared<Block>(Block::BracketStyle);
+  auto token = make_shared<Token>();
+  token->set_view();
 
-    for(auto it = node.begin(); it != node.end(); it++)
-      *block << make_part_ref(*it);
+  for(const TokenPtr<> &definition : m_definitions)
+    *token << definition;
+
+  *token << m_units[index].token;
+
+  return token;
+}
+
+TokenPtr<> Document::definitions_token() const
+{
+  auto token = make_shared<Token>();
+  token->set_view();
+
+  for(const TokenPtr<> &definition : m_definitions)
+    *token << definition;
+
+  return token;
+}
+
+TokenPtr<> Document::shard_token(const size_t index,
+  const std::string &definitions) const
+{
+  auto token = make_shared<Token>();
+  token->set_view();
+
+  for(const TokenPtr<> &preamble : m_preamble)
+    *token << preamble;
 
-    auto group = make_shared<Command>("new");
-    *group << make_shared<Literal>("StaffGroup");
-    *group << block;
+  auto include = make<Command>("include");
+  *include << make<String>(definitions);
 
-    return group;
+  *token << std::move(include);
+  *token << m_units[index].token;
+
+  return token;
+}
+
+vector<string> Document::prune()
+{
+  set<string> used;
+
+  for(const Unit &unit : m_units) {
+    const vector<string> refs = part_refs(unit);
+    used.insert(refs.begin(), refs.end());
   }
-  else
-    return make_shared<Command>(id(node.as<string>()));
+
+  return keep_parts(used);
 }
 
-TokenPtr<> Document::make_book(const YAML::Node &node) const
+void Document::add_definition(const TokenPtr<> &token)
 {
-  if(!node.IsSequence())
-    throw Error("a book must be an array of scores");
+  *m_token << token;
+  m_entries.push_back(token);
+  m_definitions.push_back(token);
+}
+
+void Document::add_unit(const Unit &unit)
+{
+  *m_token << unit.token;
+  m_entries.push_back(unit.token);
+  m_units.push_back(unit);
+}
 
-  auto block = make_shared<Block>(Block::BraceStyle);
+vector<string> Document::keep_parts(const set<string> &names)
+{
+  set<TokenPtr<> > removed;
+  vector<string> removed_names;
 
-  for(auto it = node.begin(); it != node.end(); it++)
-    *block << make_score(*it);
+  for(const auto &part : m_parts) {
+    if(!names.count(part.first)) {
+      removed.insert(part.second);
+      removed_names.push_back(part.first);
+    }
+  }
 
-  auto book = make_shared<Command>("book");
-  *book << block;
+  remove(removed);
 
-  return book;
+  return removed_names;
+}
+
+void Document::remove(const set<TokenPtr<> > &tokens)
+{
+  const auto removed = [&](const TokenPtr<> &token) {
+    return tokens.count(token) > 0;
+  };
+
+  m_entries.erase(remove_if(m_entries.begin(), m_entries.end(), removed),
+    m_entries.end());
+  m_definitions.erase(remove_if(m_definitions.begin(), m_definitions.end(),
+    removed), m_definitions.end());
+
+  m_parts.erase(remove_if(m_parts.begin(), m_parts.end(),
+    [&](const pair<string, TokenPtr<> > &part) {
+      return removed(part.second);
+    }), m_parts.end());
+
+  m_units.erase(remove_if(m_units.begin(), m_units.end(),
+    [&](const Unit &unit) { return removed(unit.token); }), m_units.end());
+
+  m_token->clear();
+
+  for(const TokenPtr<> &entry : m_entries)
+    *m_token << entry;
 }
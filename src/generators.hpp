@@ -1,10 +1,11 @@
 #ifndef GENERATORS_HPP
 #define GENERATORS_HPP
 
-#include <boost/bimap.hpp>
 #include <boost/function.hpp>
+#include <set>
 #include <string>
 
+#include "context.hpp"
 #include "tokens.hpp"
 
 namespace YAML
@@ -12,34 +13,62 @@ namespace YAML
   class Node;
 };
 
-typedef boost::bimap<std::string, std::string> IdentifierMap;
-typedef IdentifierMap::value_type Identifier;
+enum DocumentKey { D_INVALID, D_VERSION, D_HEADER, D_PAPER, D_SETUP,
+  D_PARTS, D_BOOK, D_SCORE , D_GSTAFF_SIZE };
+
+enum PartKey { P_INVALID, P_NAME, P_TYPE, P_RELATIVE, P_INSTRUMENT,
+  P_PARTS, P_PREFIX };
+
+DocumentKey document_key(const std::string &);
+PartKey part_key(const std::string &);
 
 class Generator
 {
 public:
+  Generator(Context &context) : m_context(context) {}
+
   virtual void read_yaml(const YAML::Node &node) = 0;
-  TokenPtr<> token() const { return m_token; }
+  const TokenPtr<> &token() const { return m_token; }
 
 protected:
-  static boost::bimap<std::string, std::string> s_identifiers;
+  template <class T, class... Args>
+  TokenPtr<T> make(Args &&... args) const
+  {
+    return m_context.make<T>(std::forward<Args>(args)...);
+  }
+
+  template <class T, class... Args>
+  TokenPtr<T> intern(const Args &... args) const
+  {
+    return m_context.intern<T>(args...);
+  }
 
-  TokenPtr<> make_variable(const std::string &, const YAML::Node &) const;
-  TokenPtr<> make_value(const YAML::Node &) const;
+  template <class T, class... Args>
+  TokenPtr<T> intern_node(std::initializer_list<TokenPtr<> > children,
+    const Args &... args) const
+  {
+    return m_context.intern_node<T>(children, args...);
+  }
+
+  TokenPtr<> make_variable(const std::string &, const std::string &) const;
+  TokenPtr<> make_value(const std::string &) const;
 
   std::string id(const std::string &name) const;
 
+  Context &m_context;
   TokenPtr<> m_token;
 };
 
 class KeyValue : public Generator
 {
 public:
-  KeyValue();
+  KeyValue(Context &);
   void read_yaml(const YAML::Node &) override;
 
+  void add(const std::string &key, const std::string &value);
+
   typedef boost::function<bool(const std::string &,
-    const YAML::Node &)> SpecialHandler;
+    const std::string &)> SpecialHandler;
 
   void add_handler(SpecialHandler h) { m_handlers.push_back(h); }
 
@@ -50,20 +79,25 @@ private:
 class Part : public Generator
 {
 public:
-  static Part from_yaml(const std::string &, const YAML::Node &);
-
-  Part(const std::string &name);
+  Part(const std::string &name, Context &);
   void read_yaml(const YAML::Node &) override;
 
+  void set_names(const std::string &long_name, const std::string &short_name);
+  void set_type(const std::string &);
+  void set_relative(const std::string &);
+  void set_instrument(const std::string &);
+  void set_prefix(const bool prefix) { m_part_prefix = prefix; }
+  Part add_sub_part(const std::string &key);
+
   const std::string &name() const { return m_name; }
   const std::string &identifier() const { return m_id; }
-  const TokenPtr<Command> staff() const { return m_staff; }
+  const TokenPtr<Command> &staff() const { return m_staff; }
 
 private:
   void prepare_with();
   void prepare_music();
 
-  void set_names(const YAML::Node &);
+  void read_names(const YAML::Node &);
   void add_sub_parts(const YAML::Node &);
 
   TokenPtr<Command> m_staff;
@@ -80,12 +114,131 @@ private:
   bool m_part_prefix;
 };
 
+class Score : public Generator
+{
+public:
+  Score(Context &);
+  void read_yaml(const YAML::Node &) override;
+
+  void add_part_ref(const std::string &name);
+  void begin_group();
+  void end_group();
+
+  KeyValue &layout();
+  KeyValue &midi();
+  KeyValue &header();
+
+  // Drops the layout block and enables the midi one.
+  void set_midi_only();
+
+  const std::vector<std::string> &part_refs() const { return *m_part_refs; }
+
+private:
+  void read_part_ref(const YAML::Node &);
+
+  std::vector<TokenPtr<Block> > m_blocks;
+  std::shared_ptr<std::vector<std::string> > m_part_refs;
+
+  TokenPtr<Command> m_layout;
+  TokenPtr<Command> m_midi;
+  TokenPtr<Command> m_header;
+
+  KeyValue m_layout_block;
+  KeyValue m_midi_block;
+  KeyValue m_header_block;
+};
+
+class Book : public Generator
+{
+public:
+  Book(Context &);
+  void read_yaml(const YAML::Node &) override;
+
+  Score add_score();
+
+  std::shared_ptr<const std::vector<Score> > scores() const
+  {
+    return m_scores;
+  }
+
+private:
+  TokenPtr<Block> m_block;
+  std::shared_ptr<std::vector<Score> > m_scores;
+};
+
 class Document : public Generator
 {
 public:
-  Document();
+  // Scores and books can each be compiled by LilyPond on their own, along
+  // with the definitions (header, paper, setup and parts).
+  enum UnitType { ScoreUnit, BookUnit };
+
+  struct Unit
+  {
+    UnitType type;
+    TokenPtr<> token;
+
+    // the scores of the unit, unless it was inserted as code
+    std::shared_ptr<const std::vector<Score> > scores;
+
+    // the parts referenced by a unit inserted as code
+    std::vector<std::string> part_refs;
+  };
+
+  // Each document has its own generation context. In arena mode, every
+  // token of the document is owned by the document and freed along with it.
+  Document(bool use_arena = false);
   void read_yaml(const YAML::Node &) override;
 
+  void set_version(const std::string &);
+  void set_global_staff_size(const std::string &);
+
+  KeyValue &header() { return m_header; }
+  KeyValue &paper() { return m_paper; }
+  KeyValue &setup() { return m_setup; }
+
+  Part add_part(const std::string &name);
+  Score add_score();
+  Book add_book();
+
+  // Inserts a part built separately, or code generated earlier such as a
+  // cached fragment, in its compact layout too if not empty.
+  void add_part_token(const std::string &name, const TokenPtr<> &);
+  void add_part_code(const std::string &name, const std::string &code,
+    const std::string &compact_code = std::string());
+  void add_unit_code(UnitType, const std::string &code,
+    const std::string &compact_code,
+    const std::vector<std::string> &part_refs);
+
+  const std::vector<Unit> &units() const { return m_units; }
+  std::vector<std::string> part_refs(const Unit &) const;
+
+  // Keeps only the given unit and the parts it uses. Its scores produce
+  // MIDI only, so that LilyPond skips the page layout.
+  void preview_unit(size_t index);
+
+  // Replaces the units with a MIDI only score of the given parts.
+  void preview_parts(const std::vector<std::string> &names);
+
+  // Removes the parts no score or book references. Returns their names.
+  std::vector<std::string> prune();
+
+  // The definitions followed by the given unit, as a document of its own.
+  // These wrappers are views, not tracked by the shared definitions: they
+  // may be dropped after the document, but not written.
+  TokenPtr<> unit_token(size_t index) const;
+
+  // The definitions alone, and a unit including them from another file.
+  TokenPtr<> definitions_token() const;
+  TokenPtr<> shard_token(size_t index, const std::string &definitions) const;
+
+  IdentifierMap &identifiers() { return m_context.identifiers(); }
+
+  // A context to build parts of the document from another thread. Its
+  // identifiers are on top of the document's and its tokens live as long
+  // as the document.
+  Context &add_context();
+
 private:
   void prepare_header();
   void prepare_paper();
@@ -93,9 +246,23 @@ private:
 
   void add_parts(const YAML::Node &);
 
-  TokenPtr<> make_score(const YAML::Node &) const;
-  TokenPtr<> make_part_ref(const YAML::Node &) const;
-  TokenPtr<> make_book(const YAML::Node &) const;
+  void add_definition(const TokenPtr<> &);
+  void add_unit(const Unit &);
+  TokenPtr<> make_code(const std::string &code,
+    const std::string &compact_code) const;
+
+  // Removes the parts missing from the set, returns their names.
+  std::vector<std::string> keep_parts(const std::set<std::string> &);
+  void remove(const std::set<TokenPtr<> > &);
+
+  Context m_own_context;
+  std::vector<std::unique_ptr<Context> > m_contexts;
+
+  std::vector<TokenPtr<> > m_preamble;
+  std::vector<TokenPtr<> > m_entries;
+  std::vector<TokenPtr<> > m_definitions;
+  std::vector<std::pair<std::string, TokenPtr<> > > m_parts;
+  std::vector<Unit> m_units;
 
   TokenPtr<String> m_version;
 
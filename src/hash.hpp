@@ -0,0 +1,36 @@
+#ifndef HASH_HPP
+#define HASH_HPP
+
+#include <cstdint>
+#include <string>
+
+// 64-bit FNV-1a, stable across platforms and runs
+const uint64_t HASH_BASIS = 0xcbf29ce484222325ULL;
+const uint64_t HASH_PRIME = 0x100000001b3ULL;
+
+inline uint64_t hash_bytes(const char *data, const size_t size,
+  uint64_t hash = HASH_BASIS)
+{
+  for(size_t i = 0; i < size; i++) {
+    hash ^= (unsigned char)data[i];
+    hash *= HASH_PRIME;
+  }
+
+  return hash;
+}
+
+inline uint64_t hash_string(const std::string &str,
+  const uint64_t hash = HASH_BASIS)
+{
+  return hash_bytes(str.data(), str.size(), hash);
+}
+
+// compile-time version of hash_string, usable as a case label
+constexpr uint64_t hash_literal(const char *str,
+  const uint64_t hash = HASH_BASIS)
+{
+  return *str ? hash_literal(str + 1,
+    (hash ^ (unsigned char)*str) * HASH_PRIME) : hash;
+}
+
+#endif
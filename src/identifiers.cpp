@@ -0,0 +1,106 @@
+#include "identifiers.hpp"
+
+#include <algorithm>
+
+#include "hash.hpp"
+
+using namespace std;
+
+const size_t ID_LENGTH = 8;
+
+static string hash_letters(uint64_t hash)
+{
+  string letters(ID_LENGTH, 'a');
+
+  for(char &c : letters) {
+    c = 'a' + hash % 26;
+    hash /= 26;
+  }
+
+  return letters;
+}
+
+const string &IdentifierMap::get(const string &name)
+{
+  const string &identifier = lookup(name);
+
+  if(m_log)
+    m_log->emplace_back(name, identifier);
+
+  return identifier;
+}
+
+const string &IdentifierMap::lookup(const string &name)
+{
+  const auto match = m_identifiers.find(name);
+
+  if(match != m_identifiers.end())
+    return match->second;
+
+  if(m_base) {
+    const auto base_match = m_base->m_identifiers.find(name);
+
+    if(base_match != m_base->m_identifiers.end())
+      return base_match->second;
+  }
+
+  const string identifier = next_free(name);
+  m_taken.insert(identifier);
+
+  return m_identifiers.emplace(name, identifier).first->second;
+}
+
+string IdentifierMap::next_free(const string &name) const
+{
+  string alphaName = name;
+  alphaName.erase(remove_if(alphaName.begin(), alphaName.end(),
+    [](const char c) { return !isalnum(c); }), alphaName.end());
+
+  uint64_t hash = hash_string(name);
+  string identifier;
+
+  // on collision, rehash until an unused identifier is found
+  do {
+    identifier = "pm_" + hash_letters(hash) + "_" + alphaName;
+    hash = hash_bytes((const char *)&hash, sizeof(hash), hash);
+  } while(taken(identifier));
+
+  return identifier;
+}
+
+bool IdentifierMap::taken(const string &identifier) const
+{
+  return m_taken.count(identifier) || (m_base && m_base->taken(identifier));
+}
+
+bool IdentifierMap::restore(const Entries &entries)
+{
+  vector<string> added;
+  bool ok = true;
+
+  // a new name must get the identifier get() would give it now, so the
+  // output does not depend on what was restored
+  for(const auto &entry : entries) {
+    const auto match = m_identifiers.find(entry.first);
+
+    if(match != m_identifiers.end())
+      ok = match->second == entry.second;
+    else if((ok = next_free(entry.first) == entry.second)) {
+      m_identifiers.emplace(entry.first, entry.second);
+      m_taken.insert(entry.second);
+      added.push_back(entry.first);
+    }
+
+    if(!ok)
+      break;
+  }
+
+  if(!ok) {
+    for(const string &name : added) {
+      m_taken.erase(m_identifiers[name]);
+      m_identifiers.erase(name);
+    }
+  }
+
+  return ok;
+}
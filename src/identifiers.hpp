@@ -0,0 +1,48 @@
+#ifndef IDENTIFIERS_HPP
+#define IDENTIFIERS_HPP
+
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+
+class IdentifierMap
+{
+public:
+  typedef std::vector<std::pair<std::string, std::string> > Entries;
+
+  // A map on top of a base one sees the identifiers of the base but only
+  // adds new ones to itself. The base must not change meanwhile, so that
+  // several maps can share it from different threads.
+  IdentifierMap(const IdentifierMap *base = nullptr)
+    : m_base(base), m_log(nullptr) {}
+
+  // Returns the lilypond identifier of a part (or other named definition).
+  // The identifier is derived from a hash of the name, so the same input
+  // always produces the same output.
+  const std::string &get(const std::string &name);
+
+  // Registers identifiers obtained from a previous run. Fails without
+  // registering anything unless each of them is what get() would return.
+  bool restore(const Entries &);
+
+  // Records every identifier returned by get() into the log, if not null.
+  void set_log(Entries *log) { m_log = log; }
+
+  size_t size() const { return m_identifiers.size(); }
+
+private:
+  const std::string &lookup(const std::string &name);
+  std::string next_free(const std::string &name) const;
+
+  bool taken(const std::string &identifier) const;
+
+  const IdentifierMap *m_base;
+  Entries *m_log;
+
+  std::unordered_map<std::string, std::string> m_identifiers;
+  std::unordered_set<std::string> m_taken;
+};
+
+#endif
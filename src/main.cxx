@@ -1,39 +1,327 @@
+#include <algorithm>
 #include <boost/format.hpp>
 #include <boost/program_options.hpp>
 #include <iostream>
+#include <map>
+#include <memory>
+#include <sstream>
 #include <sys/ioctl.h>
-#include <yaml-cpp/yaml.h>
 
+#include "cache.hpp"
+#include "compile.hpp"
+#include "error.hpp"
 #include "generators.hpp"
+#include "output.hpp"
+#include "parallel.hpp"
+#include "parser.hpp"
+#include "reader.hpp"
+#include "store.hpp"
+#include "watch.hpp"
 
 using namespace std;
 using namespace boost;
 
-bool process(const string &file)
+const string PARTMAN_EXT = ".partman";
+
+// how long the input files must stay unchanged before regenerating
+const int WATCH_QUIET_MS = 200;
+
+static bool is_partman_syntax(const string &file)
 {
-  cerr << format("Pre-Processing '%s'") % file << endl;
+  return file.size() > PARTMAN_EXT.size() &&
+    file.compare(file.size() - PARTMAN_EXT.size(), string::npos,
+      PARTMAN_EXT) == 0;
+}
 
-  Document doc;
+struct Options
+{
+  unsigned int jobs;
+  unsigned int part_jobs;
+  ParallelWrite render;
+  const FragmentCache *cache;
+  bool compile;
+  string split_dir;
+  string preview_unit;
+  vector<string> preview_parts;
+  bool prune;
+  bool compact;
+};
 
-  try {
-    vector<YAML::Node> yaml;
+// a file of the split output, rendered once all the documents are built
+struct Shard
+{
+  string path;
+  TokenPtr<> token;
+};
+
+struct Result
+{
+  bool ok;
+  string errors;
+  vector<CompileJob> jobs;
+
+  std::shared_ptr<Document> doc;
+  vector<Shard> shards;
+};
+
+// base name of the files compiled from the input file
+static string stem(const string &file)
+{
+  if(file == "-")
+    return "stdin";
+
+  const size_t slash = file.rfind('/');
+  const string name = slash == string::npos ? file : file.substr(slash + 1);
+
+  return name.substr(0, name.rfind('.'));
+}
+
+// base names of the files of each score and book of the document
+static vector<string> unit_names(const string &file, const Document &doc)
+{
+  vector<string> names;
+  unsigned int counts[2] = {0, 0};
+
+  for(const Document::Unit &unit : doc.units()) {
+    const char *kind = unit.type == Document::BookUnit ? "book" : "score";
+    names.push_back((format("%s-%s%d")
+      % stem(file) % kind % ++counts[unit.type]).str());
+  }
+
+  return names;
+}
+
+// The files compiled or split from each input file are named after its
+// stem, which must not be shared by two input files.
+static void check_stems(const vector<string> &files)
+{
+  map<string, string> seen;
+
+  for(const string &file : files) {
+    const auto it = seen.insert({stem(file), file});
+
+    if(!it.second) {
+      throw Error(format("'%s' and '%s' would write the same files")
+        % it.first->second % file);
+    }
+  }
+}
 
-    if(file == "-")
-      yaml = YAML::LoadAll(cin);
+Result process(const string &file, const Options &options)
+{
+  Result result{false, "", {}, nullptr, {}};
+
+  result.doc = std::make_shared<Document>(true);
+  Document &doc = *result.doc;
+
+  try {
+    if(is_partman_syntax(file))
+      Parser(doc).parse_file(file);
+    else if(file == "-")
+      YamlReader(doc, options.cache, options.part_jobs).read(cin);
     else
-      yaml = YAML::LoadAllFromFile(file);
+      YamlReader(doc, options.cache, options.part_jobs).read_file(file);
+  }
+  catch(std::exception &err) {
+    result.errors = (format("%s: %s\n") % file % err.what()).str();
+    return result;
+  }
+
+  try {
+    if(!options.preview_unit.empty()) {
+      const vector<string> names = unit_names(file, doc);
+      const string name = stem(file) + "-" + options.preview_unit;
+      const auto match = find(names.begin(), names.end(), name);
 
-    for(YAML::Node &root : yaml)
-      doc.read_yaml(root);
+      if(match == names.end()) {
+        throw Error(format("no score or book named '%s'")
+          % options.preview_unit);
+      }
+
+      doc.preview_unit(match - names.begin());
+    }
+    else if(!options.preview_parts.empty())
+      doc.preview_parts(options.preview_parts);
+    else if(options.prune) {
+      for(const string &name : doc.prune()) {
+        result.errors += (format("%s: pruned unreferenced part '%s'\n")
+          % file % name).str();
+      }
+    }
   }
   catch(std::exception &err) {
-    cerr << format("%s: %s") % file % err.what() << endl;
+    result.errors = (format("%s: %s\n") % file % err.what()).str();
+    return result;
+  }
+
+  result.ok = true;
+
+  const vector<string> names = unit_names(file, doc);
+
+  if(options.compile) {
+    for(size_t i = 0; i < names.size(); i++)
+      result.jobs.push_back({names[i], doc.unit_token(i)->code()});
+  }
+
+  if(!options.split_dir.empty()) {
+    const string definitions = stem(file) + ".ly";
+
+    result.shards.push_back({options.split_dir + "/" + definitions,
+      doc.definitions_token()});
+
+    for(size_t i = 0; i < names.size(); i++) {
+      result.shards.push_back({options.split_dir + "/" + names[i] + ".ly",
+        doc.shard_token(i, definitions)});
+    }
+  }
+
+  return result;
+}
+
+// Each file gets its own document and context. The files are generated
+// in parallel and their errors reported in order.
+static void generate(const vector<string> &files,
+  const vector<size_t> &indices, const Options &options,
+  vector<Result> *results)
+{
+  parallel_for(indices.size(), options.jobs, [&](size_t i) {
+    (*results)[indices[i]] = process(files[indices[i]], options);
+  });
+
+  for(const size_t i : indices) {
+    cerr << format("Pre-Processing '%s'") % files[i] << endl;
+    cerr << (*results)[i].errors;
+  }
+}
+
+// Writes the output of all the files, in order, to the output file or to
+// the standard output. Returns false if any file failed.
+static bool emit_output(const vector<Result> &results,
+  const string &output_file, const Options &options)
+{
+  bool all_ok = true;
+
+  for(const Result &result : results)
+    all_ok = result.ok && all_ok;
+
+  // a failed run must not replace the previous output
+  if(!output_file.empty() && !all_ok)
     return false;
+
+  try {
+    unique_ptr<FileSink> sink(output_file.empty()
+      ? new FileSink(STDOUT_FILENO) : new FileSink(output_file));
+
+    ostream stream(sink.get());
+    set_compact(stream, options.compact);
+
+    if(options.render.threshold > 0)
+      set_parallel(stream, &options.render);
+
+    for(const Result &result : results) {
+      if(result.ok)
+        stream << result.doc->token();
+    }
+
+    sink->commit();
   }
+  catch(std::exception &err) {
+    cerr << err.what() << endl;
+    return false;
+  }
+
+  return all_ok;
+}
+
+// Compiles the scores and books of the given files, returns false if any
+// of them failed.
+static bool compile(const Compiler &compiler, const vector<size_t> &indices,
+  const vector<Result> &results, const unsigned int jobs)
+{
+  vector<CompileJob> units;
+
+  for(const size_t i : indices) {
+    if(results[i].ok)
+      units.insert(units.end(), results[i].jobs.begin(), results[i].jobs.end());
+  }
+
+  const vector<CompileResult> compiled = compiler.run(units, jobs);
+  bool all_ok = true;
+
+  for(size_t i = 0; i < units.size(); i++) {
+    const string path = compiler.source_path(units[i]);
+    const CompileResult &result = compiled[i];
+
+    if(result.restored) {
+      cerr << format("Restored '%s' from the compile cache") % path << endl;
+      continue;
+    }
+    else if(result.status == 0) {
+      cerr << format("Compiled '%s' in %.2fs") % path % result.seconds
+        << endl;
+      continue;
+    }
 
-  cout << doc.token();
+    if(!result.error.empty())
+      cerr << format("Cannot compile '%s': %s") % path % result.error << endl;
+    else if(result.status < 0)
+      cerr << format("Cannot run the compiler for '%s'") % path << endl;
+    else {
+      cerr << format("Compiling '%s' failed with status %d after %.2fs, "
+        "see '%s'") % path % result.status % result.seconds
+        % compiler.log_path(units[i]) << endl;
+    }
+
+    all_ok = false;
+  }
 
-  return true;
+  return all_ok;
+}
+
+// Writes the shards of all the files in parallel, leaving the unchanged
+// ones untouched. Returns false if any file failed.
+static bool emit_shards(const vector<Result> &results, const Options &options)
+{
+  vector<const Shard *> shards;
+  bool all_ok = true;
+
+  for(const Result &result : results) {
+    for(const Shard &shard : result.shards)
+      shards.push_back(&shard);
+
+    all_ok = result.ok && all_ok;
+  }
+
+  try {
+    parallel_for(shards.size(), options.jobs, [&](size_t i) {
+      FileSink sink(shards[i]->path);
+      ostream stream(&sink);
+      set_compact(stream, options.compact);
+
+      stream << shards[i]->token;
+      sink.commit();
+    });
+  }
+  catch(std::exception &err) {
+    cerr << err.what() << endl;
+    return false;
+  }
+
+  return all_ok;
+}
+
+static bool emit(const vector<Result> &results, const string &output_file,
+  const Options &options)
+{
+  if(options.split_dir.empty())
+    return emit_output(results, output_file, options);
+
+  bool ok = emit_shards(results, options);
+
+  if(!output_file.empty())
+    ok = emit_output(results, output_file, options) && ok;
+
+  return ok;
 }
 
 int main(int argc, char *argv[])
@@ -52,6 +340,60 @@ int main(int argc, char *argv[])
     ("input,i", po::value<vector<string> >()->value_name("FILE")
       ->default_value(default_files, "-"), "list of files to process")
 
+    ("jobs,j", po::value<unsigned int>()->value_name("N")
+      ->default_value(default_jobs()), "number of threads processing the "
+     "files, then the parts and large blocks of each file, in parallel; also "
+     "the number of LilyPond processes run at once")
+
+    ("render-threshold", po::value<size_t>()->value_name("N")
+      ->default_value(256), "render the children of blocks having at least N "
+     "of them in parallel (0 disables)")
+
+    ("output,o", po::value<string>()->value_name("FILE"),
+     "write to FILE instead of the standard output, leaving it untouched "
+     "if it is up to date")
+
+    ("compact",
+     "write the code with minimal whitespace and without comments")
+
+    ("cache", po::value<string>()->value_name("DIR"),
+     "reuse the parts and scores generated by previous runs")
+
+    ("split", po::value<string>()->value_name("DIR"),
+     "write the definitions of each input file to DIR/<input>.ly and each "
+     "score and book to a file of its own including them")
+
+    ("preview", po::value<string>()->value_name("UNIT"),
+     "generate only the given score or book (score1, book2...) and the parts "
+     "it uses, producing MIDI only")
+
+    ("preview-parts", po::value<string>()->value_name("PARTS"),
+     "generate a MIDI only score of the given comma-separated parts")
+
+    ("prune", "leave out the parts no score or book uses")
+
+    ("compile,c",
+     "run LilyPond on each score and book, in parallel")
+
+    ("lilypond", po::value<string>()->value_name("PROGRAM")
+      ->default_value("lilypond"), "LilyPond executable used by --compile")
+
+    ("include,I", po::value<vector<string> >()->value_name("DIR"),
+     "directory where LilyPond looks for included files, passed with -I")
+
+    ("compile-dir", po::value<string>()->value_name("DIR")
+      ->default_value("lilypond-out"),
+     "where --compile writes the sources, outputs and logs")
+
+    ("compile-cache", po::value<string>()->value_name("DIR"),
+     "reuse the outputs of scores and books already compiled")
+
+    ("compile-cache-size", po::value<unsigned int>()->value_name("MB")
+      ->default_value(1024), "size limit of the compile cache")
+
+    ("watch,w",
+     "keep running and regenerate the output when an input file changes")
+
     ("help,h",
      "display this help and exit")
     ("version,v",
@@ -85,10 +427,147 @@ int main(int argc, char *argv[])
     return EXIT_SUCCESS;
   }
 
-  bool all_ok = true;
+  const vector<string> &files = opts["input"].as<vector<string> >();
+  const bool watch = opts.count("watch") > 0;
+
+  string output_file;
+
+  if(opts.count("output"))
+    output_file = opts["output"].as<string>();
+
+  string split_dir;
+
+  if(opts.count("split"))
+    split_dir = opts["split"].as<string>();
+
+  if(watch && output_file.empty() && split_dir.empty()) {
+    cerr << "--watch requires --output or --split" << endl;
+    return EXIT_FAILURE;
+  }
+
+  const bool compact = opts.count("compact") > 0;
 
-  for(const string file : opts["input"].as<vector<string> >())
-    all_ok = process(file) && all_ok;
+  unique_ptr<FragmentCache> cache;
+  unique_ptr<ResultStore> store;
+  unique_ptr<Compiler> compiler;
+  unique_ptr<Watcher> watcher;
 
-  return all_ok ? EXIT_SUCCESS : EXIT_FAILURE;
+  try {
+    if(opts.count("compile-cache")) {
+      store.reset(new ResultStore(opts["compile-cache"].as<string>(),
+        opts["compile-cache-size"].as<unsigned int>() * 1024ULL * 1024));
+    }
+
+    if(opts.count("compile")) {
+      vector<string> include_paths;
+
+      if(opts.count("include"))
+        include_paths = opts["include"].as<vector<string> >();
+
+      compiler.reset(new Compiler(opts["lilypond"].as<string>(),
+        opts["compile-dir"].as<string>(), store.get(), include_paths));
+    }
+
+    if(opts.count("cache"))
+      cache.reset(new FragmentCache(opts["cache"].as<string>(), compact));
+
+    if(compiler || !split_dir.empty())
+      check_stems(files);
+
+    if(!split_dir.empty())
+      make_directory(split_dir);
+
+    if(watch) {
+      // keep the generated fragments in memory for the whole session
+      if(!cache)
+        cache.reset(new FragmentCache("", compact));
+
+      watcher.reset(new Watcher);
+
+      for(const string &file : files) {
+        if(file == "-")
+          throw Error("cannot watch the standard input");
+
+        watcher->add(file);
+      }
+    }
+  }
+  catch(std::exception &err) {
+    cerr << err.what() << endl;
+    return EXIT_FAILURE;
+  }
+
+  vector<Result> results(files.size());
+  vector<size_t> indices(files.size());
+
+  for(size_t i = 0; i < files.size(); i++)
+    indices[i] = i;
+
+  const unsigned int jobs = opts["jobs"].as<unsigned int>();
+
+  // the jobs not needed for the files build the parts of each file
+  const unsigned int part_jobs = max<unsigned int>(1, jobs / files.size());
+
+  const ParallelWrite render{part_jobs,
+    opts["render-threshold"].as<size_t>()};
+
+  Options options{jobs, part_jobs, render, cache.get(), compiler != nullptr,
+    split_dir, "", {}, opts.count("prune") > 0, compact};
+
+  if(opts.count("preview"))
+    options.preview_unit = opts["preview"].as<string>();
+
+  if(opts.count("preview-parts")) {
+    stringstream list(opts["preview-parts"].as<string>());
+    string name;
+
+    while(getline(list, name, ','))
+      options.preview_parts.push_back(name);
+  }
+
+  // previews change the scores, which must not come from the cache
+  if(!options.preview_unit.empty() || !options.preview_parts.empty())
+    options.cache = nullptr;
+
+  generate(files, indices, options, &results);
+
+  bool ok = emit(results, output_file, options);
+
+  if(compiler) {
+    try {
+      ok = compile(*compiler, indices, results, options.jobs) && ok;
+    }
+    catch(std::exception &err) {
+      cerr << err.what() << endl;
+      ok = false;
+    }
+  }
+
+  if(!watch)
+    return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+
+  try {
+    for(;;) {
+      const vector<string> changed = watcher->wait(WATCH_QUIET_MS);
+
+      // only the files that changed are read again, the output of the
+      // others is kept from the previous runs
+      indices.clear();
+
+      for(size_t i = 0; i < files.size(); i++) {
+        if(find(changed.begin(), changed.end(), files[i]) != changed.end())
+          indices.push_back(i);
+      }
+
+      generate(files, indices, options, &results);
+      emit(results, output_file, options);
+
+      if(compiler)
+        compile(*compiler, indices, results, options.jobs);
+    }
+  }
+  catch(std::exception &err) {
+    cerr << err.what() << endl;
+    return EXIT_FAILURE;
+  }
 }
@@ -0,0 +1,406 @@
+#include "output.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <boost/format.hpp>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <dirent.h>
+#include <fcntl.h>
+#include <fstream>
+#include <sstream>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include "error.hpp"
+
+using namespace std;
+using format = boost::format;
+
+const size_t BUFFER_SIZE = 64 * 1024;
+const size_t BUFFER_COUNT = 4;
+const size_t BUFFER_ALIGN = 4096;
+
+static char *allocate_buffer()
+{
+  void *buffer;
+
+  if(posix_memalign(&buffer, BUFFER_ALIGN, BUFFER_SIZE))
+    throw bad_alloc();
+
+  return static_cast<char *>(buffer);
+}
+
+FileSink::FileSink(const string &path)
+  : m_path(path), m_fd(-1), m_old_fd(-1), m_matched(0), m_written(false),
+    m_current(0), m_scratch(nullptr)
+{
+  allocate_buffers(true);
+
+  // opened last, as the destructor does not run if the constructor throws
+  m_old_fd = open(path.c_str(), O_RDONLY);
+}
+
+FileSink::FileSink(const int fd)
+  : m_fd(fd), m_old_fd(-1), m_matched(0), m_written(false), m_current(0),
+    m_scratch(nullptr)
+{
+  allocate_buffers(false);
+}
+
+FileSink::~FileSink()
+{
+  if(m_path.empty()) {
+    try {
+      flush();
+    }
+    catch(...) {}
+  }
+  else {
+    // not committed, or failed
+    if(m_fd >= 0) {
+      close(m_fd);
+      unlink(m_temp.c_str());
+    }
+
+    if(m_old_fd >= 0)
+      close(m_old_fd);
+  }
+
+  for(char *buffer : m_buffers)
+    free(buffer);
+
+  free(m_scratch);
+}
+
+FileSink::int_type FileSink::overflow(const int_type c)
+{
+  try {
+    next_buffer();
+  }
+  catch(const std::exception &err) {
+    if(m_error.empty())
+      m_error = err.what();
+
+    return traits_type::eof();
+  }
+
+  if(!traits_type::eq_int_type(c, traits_type::eof())) {
+    *pptr() = traits_type::to_char_type(c);
+    pbump(1);
+  }
+
+  return traits_type::not_eof(c);
+}
+
+streamsize FileSink::xsputn(const char *data, const streamsize size)
+{
+  try {
+    // too big to be worth copying
+    if((size_t)size >= BUFFER_SIZE) {
+      flush(data, size);
+      return size;
+    }
+
+    streamsize left = size;
+
+    while(left > 0) {
+      if(pptr() == epptr())
+        next_buffer();
+
+      const streamsize room = min(left, streamsize(epptr() - pptr()));
+      memcpy(pptr(), data, room);
+      pbump(room);
+
+      data += room;
+      left -= room;
+    }
+  }
+  catch(const std::exception &err) {
+    if(m_error.empty())
+      m_error = err.what();
+
+    return 0;
+  }
+
+  return size;
+}
+
+int FileSink::sync()
+{
+  try {
+    flush();
+  }
+  catch(const std::exception &err) {
+    if(m_error.empty())
+      m_error = err.what();
+
+    return -1;
+  }
+
+  return 0;
+}
+
+bool FileSink::commit()
+{
+  if(!m_error.empty())
+    throw Error(m_error);
+
+  flush();
+
+  if(m_path.empty())
+    return m_written;
+
+  if(m_fd < 0) {
+    char extra;
+
+    // a longer or missing file must be replaced as well
+    if(m_old_fd < 0 || pread(m_old_fd, &extra, 1, m_matched) != 0)
+      diverge();
+    else {
+      close(m_old_fd);
+      m_old_fd = -1;
+      return false;
+    }
+  }
+
+  const int fd = m_fd;
+  m_fd = -1;
+
+  // the content must be on disk before the file takes the name
+  const bool synced = !fsync(fd);
+
+  if(!synced || close(fd)) {
+    const int error = errno;
+
+    if(!synced)
+      close(fd);
+
+    unlink(m_temp.c_str());
+    throw Error(format("cannot write '%s': %s") % m_temp % strerror(error));
+  }
+
+  if(rename(m_temp.c_str(), m_path.c_str())) {
+    const int error = errno;
+    unlink(m_temp.c_str());
+    throw Error(format("cannot write '%s': %s") % m_path % strerror(error));
+  }
+
+  return true;
+}
+
+void FileSink::allocate_buffers(const bool scratch)
+{
+  try {
+    m_buffers.reserve(BUFFER_COUNT);
+
+    for(size_t i = 0; i < BUFFER_COUNT; i++)
+      m_buffers.push_back(allocate_buffer());
+
+    if(scratch)
+      m_scratch = allocate_buffer();
+  }
+  catch(...) {
+    for(char *buffer : m_buffers)
+      free(buffer);
+
+    throw;
+  }
+
+  setp(m_buffers[0], m_buffers[0] + BUFFER_SIZE);
+}
+
+void FileSink::next_buffer()
+{
+  if(m_current + 1 < m_buffers.size()) {
+    m_current++;
+    setp(m_buffers[m_current], m_buffers[m_current] + BUFFER_SIZE);
+  }
+  else
+    flush();
+}
+
+void FileSink::flush(const char *extra, const size_t extra_size)
+{
+  iovec iov[BUFFER_COUNT + 1];
+  int count = 0;
+
+  for(size_t i = 0; i <= m_current; i++) {
+    const size_t size = i < m_current ? BUFFER_SIZE : pptr() - pbase();
+
+    if(size > 0)
+      iov[count++] = {m_buffers[i], size};
+  }
+
+  if(extra_size > 0)
+    iov[count++] = {const_cast<char *>(extra), extra_size};
+
+  m_current = 0;
+  setp(m_buffers[0], m_buffers[0] + BUFFER_SIZE);
+
+  output(iov, count);
+}
+
+void FileSink::output(iovec *iov, int count)
+{
+  // compare with the existing file until they differ
+  while(m_fd < 0 && count > 0) {
+    if(m_old_fd < 0 || !matches((const char *)iov->iov_base, iov->iov_len)) {
+      diverge();
+      break;
+    }
+
+    m_matched += iov->iov_len;
+    iov++;
+    count--;
+  }
+
+  while(count > 0) {
+    const ssize_t written = writev(m_fd, iov, count);
+
+    if(written < 0) {
+      if(errno == EINTR)
+        continue;
+
+      const string name = m_path.empty() ? "output" : m_temp;
+      throw Error(format("cannot write '%s': %s") % name % strerror(errno));
+    }
+
+    m_written = true;
+
+    // skip what was written, resuming inside a partly written buffer
+    size_t left = written;
+
+    while(count > 0 && left >= iov->iov_len) {
+      left -= iov->iov_len;
+      iov++;
+      count--;
+    }
+
+    if(count > 0) {
+      iov->iov_base = (char *)iov->iov_base + left;
+      iov->iov_len -= left;
+    }
+  }
+}
+
+bool FileSink::matches(const char *data, size_t size)
+{
+  size_t offset = m_matched;
+
+  while(size > 0) {
+    const ssize_t count = pread(m_old_fd, m_scratch, min(size, BUFFER_SIZE),
+      offset);
+
+    if(count <= 0 || memcmp(m_scratch, data, count))
+      return false;
+
+    data += count;
+    size -= count;
+    offset += count;
+  }
+
+  return true;
+}
+
+void FileSink::diverge()
+{
+  static atomic<unsigned int> counter(0);
+
+  m_temp = (format("%s.%d.%d.tmp") % m_path % getpid() % counter++).str();
+  m_fd = open(m_temp.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0666);
+
+  if(m_fd < 0)
+    throw Error(format("cannot write '%s': %s") % m_temp % strerror(errno));
+
+  // the replacement keeps the permissions of the file it replaces
+  struct stat info;
+
+  if(m_old_fd >= 0 && !fstat(m_old_fd, &info) &&
+      fchmod(m_fd, info.st_mode & 07777)) {
+    throw Error(format("cannot write '%s': %s")
+      % m_temp % strerror(errno));
+  }
+
+  // the identical beginning was never written
+  for(size_t offset = 0; offset < m_matched; ) {
+    const ssize_t count = pread(m_old_fd, m_scratch,
+      min(m_matched - offset, BUFFER_SIZE), offset);
+
+    if(count <= 0) {
+      throw Error(format("cannot write '%s': %s")
+        % m_temp % strerror(errno));
+    }
+
+    // resume short writes, as output() does
+    for(ssize_t done = 0; done < count; ) {
+      const ssize_t written = write(m_fd, m_scratch + done, count - done);
+
+      if(written < 0) {
+        if(errno == EINTR)
+          continue;
+
+        throw Error(format("cannot write '%s': %s")
+          % m_temp % strerror(errno));
+      }
+
+      done += written;
+    }
+
+    offset += count;
+  }
+
+  if(m_old_fd >= 0) {
+    close(m_old_fd);
+    m_old_fd = -1;
+  }
+}
+
+bool write_if_changed(const string &path, const string &content)
+{
+  FileSink sink(path);
+  sink.sputn(content.data(), content.size());
+
+  return sink.commit();
+}
+
+void make_directory(const string &path)
+{
+  if(mkdir(path.c_str(), 0777) && errno != EEXIST) {
+    throw Error(format("cannot create directory '%s': %s")
+      % path % strerror(errno));
+  }
+}
+
+bool read_file(const string &path, string *content)
+{
+  ifstream stream(path, ios::binary);
+
+  if(!stream)
+    return false;
+
+  ostringstream buffer;
+  buffer << stream.rdbuf();
+  *content = buffer.str();
+
+  return true;
+}
+
+vector<string> list_directory(const string &path)
+{
+  vector<string> names;
+
+  if(DIR *dir = opendir(path.c_str())) {
+    while(const dirent *entry = readdir(dir)) {
+      if(entry->d_name[0] != '.')
+        names.push_back(entry->d_name);
+    }
+
+    closedir(dir);
+  }
+
+  return names;
+}
@@ -0,0 +1,73 @@
+#ifndef OUTPUT_HPP
+#define OUTPUT_HPP
+
+#include <streambuf>
+#include <string>
+#include <vector>
+
+// Stream buffer writing large aligned buffers to a file with writev.
+//
+// Given a path, the content goes to a temporary file renamed over the
+// destination by commit(), so readers never see a partial file. Until the
+// content differs from the existing file, the two are compared as the
+// buffers fill up and nothing is written: an identical result leaves the
+// file and its modification time untouched.
+class FileSink : public std::streambuf
+{
+public:
+  FileSink(const std::string &path);
+
+  // Writes straight to an open descriptor, such as the standard output.
+  FileSink(int fd);
+
+  FileSink(const FileSink &) = delete;
+  ~FileSink();
+
+  FileSink &operator=(const FileSink &) = delete;
+
+  // Flushes the buffers and, given a path, replaces the file unless it
+  // already holds that content. Returns whether anything was written.
+  bool commit();
+
+protected:
+  virtual int_type overflow(int_type) override;
+  virtual std::streamsize xsputn(const char *, std::streamsize) override;
+  virtual int sync() override;
+
+private:
+  void allocate_buffers(bool scratch);
+  void next_buffer();
+  void flush(const char *extra = nullptr, size_t extra_size = 0);
+  void output(struct iovec *, int count);
+  bool matches(const char *, size_t);
+  void diverge();
+
+  std::string m_path;
+  std::string m_temp;
+  int m_fd;
+  int m_old_fd;
+  size_t m_matched;
+  bool m_written;
+
+  std::vector<char *> m_buffers;
+  size_t m_current;
+  char *m_scratch;
+  std::string m_error;
+};
+
+// Writes content to the file at path through a FileSink, unless it already
+// holds exactly that content: its modification time is then left alone, so
+// that tools depending on it do not rebuild. Returns whether the file was
+// written.
+bool write_if_changed(const std::string &path, const std::string &content);
+
+// Creates a directory unless it already exists.
+void make_directory(const std::string &path);
+
+// Reads a whole file, returns false if it cannot be read.
+bool read_file(const std::string &path, std::string *content);
+
+// Names of the entries of a directory, except the hidden ones.
+std::vector<std::string> list_directory(const std::string &path);
+
+#endif
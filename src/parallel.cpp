@@ -0,0 +1,55 @@
+#include "parallel.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <exception>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+using namespace std;
+
+unsigned int default_jobs()
+{
+  return max(thread::hardware_concurrency(), 1u);
+}
+
+void parallel_for(const size_t count, const unsigned int jobs,
+  const function<void(size_t)> &func)
+{
+  atomic<size_t> next(0);
+  exception_ptr error;
+  mutex error_mutex;
+
+  auto worker = [&] {
+    size_t i;
+
+    while((i = next++) < count) {
+      try {
+        func(i);
+      }
+      catch(...) {
+        lock_guard<mutex> guard(error_mutex);
+
+        if(!error)
+          error = current_exception();
+
+        next = count;
+      }
+    }
+  };
+
+  const size_t thread_count = min<size_t>(max(jobs, 1u), count);
+
+  vector<thread> threads;
+  for(size_t i = 1; i < thread_count; i++)
+    threads.emplace_back(worker);
+
+  worker();
+
+  for(thread &t : threads)
+    t.join();
+
+  if(error)
+    rethrow_exception(error);
+}
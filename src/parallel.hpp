@@ -0,0 +1,16 @@
+#ifndef PARALLEL_HPP
+#define PARALLEL_HPP
+
+#include <cstddef>
+#include <functional>
+
+// Number of hardware threads (at least one).
+unsigned int default_jobs();
+
+// Calls func(i) for every i in [0, count) using up to `jobs` threads,
+// including the calling one. The first exception thrown by func is rethrown
+// once all the threads have finished.
+void parallel_for(size_t count, unsigned int jobs,
+  const std::function<void(size_t)> &func);
+
+#endif
@@ -0,0 +1,490 @@
+#include "parser.hpp"
+
+#include <boost/format.hpp>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "error.hpp"
+#include "generators.hpp"
+#include "scalar.hpp"
+
+using namespace std;
+using format = boost::format;
+
+class MappedFile
+{
+public:
+  MappedFile(const string &path) : m_data(nullptr), m_size(0)
+  {
+    const int fd = open(path.c_str(), O_RDONLY);
+
+    if(fd < 0)
+      throw Error(format("cannot open '%s': %s") % path % strerror(errno));
+
+    struct stat info;
+    if(fstat(fd, &info) == 0)
+      m_size = info.st_size;
+
+    if(m_size > 0) {
+      void *data = mmap(nullptr, m_size, PROT_READ, MAP_PRIVATE, fd, 0);
+      m_data = data == MAP_FAILED ? nullptr : (const char *)data;
+    }
+
+    const int mmap_errno = errno;
+    close(fd);
+
+    if(m_size > 0 && !m_data) {
+      throw Error(format("cannot read '%s': %s")
+        % path % strerror(mmap_errno));
+    }
+  }
+
+  ~MappedFile()
+  {
+    if(m_data)
+      munmap((void *)m_data, m_size);
+  }
+
+  const char *data() const { return m_data; }
+  size_t size() const { return m_size; }
+
+private:
+  const char *m_data;
+  size_t m_size;
+};
+
+static bool is_blank(const char c)
+{
+  return c == ' ' || c == '\t' || c == '\r';
+}
+
+static bool is_space(const char c)
+{
+  return is_blank(c) || c == '\n' || c == '\v' || c == '\f';
+}
+
+static bool is_word(const char c)
+{
+  return !is_space(c) && !strchr("{}=<>%\"\\", c);
+}
+
+bool Parser::Ref::operator==(const char *str) const
+{
+  return strlen(str) == size && !memcmp(data, str, size);
+}
+
+Parser::Parser(Document &doc)
+  : m_doc(doc), m_begin(nullptr), m_pos(nullptr), m_end(nullptr),
+    m_value_count(0)
+{
+}
+
+void Parser::parse_file(const string &path)
+{
+  const MappedFile file(path);
+  parse(file.data(), file.size());
+}
+
+void Parser::parse(const char *data, const size_t size)
+{
+  m_begin = m_pos = data;
+  m_end = data + size;
+
+  parse_document();
+}
+
+void Parser::parse_document()
+{
+  while(next_item()) {
+    const char *start = m_pos;
+
+    if(peek() == '\\') {
+      const Ref key = read_keyword();
+
+      switch(document_key(key.str())) {
+      case D_HEADER:
+        parse_key_values(m_doc.header());
+        break;
+      case D_PAPER:
+        parse_key_values(m_doc.paper());
+        break;
+      case D_SETUP:
+        parse_key_values(m_doc.setup());
+        break;
+      case D_PARTS:
+        parse_parts(m_doc);
+        break;
+      case D_SCORE: {
+        Score score = m_doc.add_score();
+        parse_score(score);
+        break;
+      }
+      case D_BOOK:
+        parse_book();
+        break;
+      default:
+        error_at(start, (format("invalid block '%s'") % key.str()).str());
+      }
+    }
+    else {
+      const Ref key = read_word();
+
+      switch(document_key(key.str())) {
+      case D_VERSION:
+        m_doc.set_version(read_value());
+        break;
+      case D_GSTAFF_SIZE:
+        m_doc.set_global_staff_size(read_value());
+        break;
+      default:
+        error_at(start, (format("invalid key '%s'") % key.str()).str());
+      }
+    }
+  }
+}
+
+void Parser::parse_key_values(KeyValue &block)
+{
+  expect('{');
+
+  while(next_item('}')) {
+    const Ref key = read_word();
+    block.add(key.str(), read_value());
+  }
+}
+
+template <class Parent>
+void Parser::parse_parts(Parent &parent)
+{
+  expect('{');
+
+  while(next_item('}')) {
+    const Ref name = read_word();
+    skip();
+
+    Part part = parent.add_part(name.str());
+    parse_part(part);
+  }
+}
+
+void Parser::parse_part(Part &part)
+{
+  // sub-parts are added through Part::add_sub_part
+  struct SubParts
+  {
+    Part &parent;
+    Part add_part(const string &key) { return parent.add_sub_part(key); }
+  } sub_parts{part};
+
+  expect('{');
+
+  while(next_item('}')) {
+    const char *start = m_pos;
+
+    if(peek() == '\\') {
+      const Ref key = read_keyword();
+
+      if(part_key(key.str()) != P_PARTS)
+        error_at(start, (format("invalid block '%s'") % key.str()).str());
+
+      parse_parts(sub_parts);
+      continue;
+    }
+
+    const Ref key = read_word();
+
+    switch(part_key(key.str())) {
+    case P_NAME:
+      read_values();
+
+      if(m_value_count > 2) {
+        error_at(start, (format("expected at most two names, "
+          "but got %d instead") % m_value_count).str());
+      }
+
+      part.set_names(m_values[0], m_values[m_value_count - 1]);
+      break;
+    case P_TYPE:
+      part.set_type(read_value());
+      break;
+    case P_RELATIVE:
+      part.set_relative(read_value());
+      break;
+    case P_INSTRUMENT:
+      part.set_instrument(read_value());
+      break;
+    case P_PREFIX: {
+      bool prefix;
+
+      if(!parse_bool(read_value(), &prefix))
+        error_at(start, "prefix must be a boolean");
+
+      part.set_prefix(prefix);
+      break;
+    }
+    default:
+      error_at(start, (format("invalid key '%s'") % key.str()).str());
+    }
+  }
+}
+
+void Parser::parse_score(Score &score)
+{
+  unsigned int groups = 0;
+
+  expect('{');
+
+  while(next_item('}')) {
+    const char *start = m_pos;
+
+    if(peek() == '\\') {
+      const Ref key = read_keyword();
+
+      if(key == "layout")
+        parse_key_values(score.layout());
+      else if(key == "midi")
+        parse_key_values(score.midi());
+      else if(key == "header")
+        parse_key_values(score.header());
+      else
+        error_at(start, (format("invalid block '%s'") % key.str()).str());
+    }
+    else if(peek() == '<') {
+      advance();
+      expect('<');
+
+      score.begin_group();
+      groups++;
+    }
+    else if(peek() == '>') {
+      advance();
+      expect('>');
+
+      if(!groups)
+        error_at(start, "unexpected '>>'");
+
+      score.end_group();
+      groups--;
+    }
+    else
+      score.add_part_ref(read_word().str());
+  }
+
+  if(groups)
+    error("missing '>>'");
+}
+
+void Parser::parse_book()
+{
+  Book book = m_doc.add_book();
+
+  expect('{');
+
+  while(next_item('}')) {
+    const char *start = m_pos;
+    const Ref key = read_keyword();
+
+    if(!(key == "score"))
+      error_at(start, (format("invalid block '%s'") % key.str()).str());
+
+    Score score = book.add_score();
+    parse_score(score);
+  }
+}
+
+bool Parser::next_item()
+{
+  skip();
+  return !at_end();
+}
+
+bool Parser::next_item(const char close)
+{
+  skip();
+
+  if(at_end())
+    error((format("missing '%c'") % close).str());
+  else if(peek() == close) {
+    advance();
+    return false;
+  }
+
+  return true;
+}
+
+Parser::Ref Parser::read_word()
+{
+  const Ref word{m_pos, 0};
+
+  while(!at_end() && is_word(*m_pos))
+    advance();
+
+  if(m_pos == word.data)
+    error("expected a name");
+
+  return Ref{word.data, size_t(m_pos - word.data)};
+}
+
+Parser::Ref Parser::read_keyword()
+{
+  expect('\\');
+  const Ref word = read_word();
+  skip();
+
+  return word;
+}
+
+void Parser::read_values()
+{
+  m_value_count = 0;
+
+  skip_blanks();
+  expect('=');
+  skip_blanks();
+
+  auto next_value = [&]() -> string & {
+    if(m_values.size() <= m_value_count)
+      m_values.resize(m_value_count + 1);
+
+    return m_values[m_value_count++];
+  };
+
+  if(peek() == '"') {
+    do {
+      next_value() = read_quoted();
+      skip_blanks();
+    } while(peek() == '"');
+
+    return;
+  }
+
+  // everything until the end of the line, a comment or an unbalanced '}'
+  const char *start = m_pos, *end = m_pos;
+  unsigned int depth = 0;
+
+  while(!at_end()) {
+    const char c = *m_pos;
+
+    if(c == '\n' || c == '%' || (c == '}' && !depth))
+      break;
+    else if(c == '{')
+      depth++;
+    else if(c == '}')
+      depth--;
+    else if(c == '"') {
+      read_quoted();
+      end = m_pos;
+      continue;
+    }
+
+    advance();
+
+    if(!is_blank(c))
+      end = m_pos;
+  }
+
+  if(start == end)
+    error("expected a value");
+
+  next_value().assign(start, end - start);
+}
+
+const string &Parser::read_value()
+{
+  const char *start = m_pos;
+
+  read_values();
+
+  if(m_value_count > 1)
+    error_at(start, "expected a single value");
+
+  return m_values[0];
+}
+
+string Parser::read_quoted()
+{
+  expect('"');
+
+  string value;
+  const char *chunk = m_pos;
+
+  while(true) {
+    if(at_end())
+      error("missing '\"'");
+
+    const char c = *m_pos;
+
+    if(c == '"')
+      break;
+    else if(c == '\\' && m_pos + 1 < m_end &&
+        (m_pos[1] == '"' || m_pos[1] == '\\')) {
+      value.append(chunk, m_pos);
+      advance();
+      chunk = m_pos;
+    }
+
+    advance();
+  }
+
+  value.append(chunk, m_pos);
+  advance();
+
+  return value;
+}
+
+void Parser::skip()
+{
+  while(!at_end()) {
+    if(*m_pos == '%') {
+      while(!at_end() && *m_pos != '\n')
+        advance();
+    }
+    else if(is_space(*m_pos))
+      advance();
+    else
+      break;
+  }
+}
+
+void Parser::skip_blanks()
+{
+  while(!at_end() && is_blank(*m_pos))
+    advance();
+}
+
+void Parser::advance()
+{
+  m_pos++;
+}
+
+void Parser::expect(const char c)
+{
+  if(peek() != c)
+    error((format("expected '%c'") % c).str());
+
+  advance();
+}
+
+void Parser::error(const string &message) const
+{
+  error_at(m_pos, message);
+}
+
+void Parser::error_at(const char *pos, const string &message) const
+{
+  unsigned int line = 1;
+  const char *line_start = m_begin;
+
+  for(const char *it = m_begin; it < pos; it++) {
+    if(*it == '\n') {
+      line++;
+      line_start = it + 1;
+    }
+  }
+
+  throw Error(format("%d:%d: %s") % line % (pos - line_start + 1) % message);
+}
@@ -0,0 +1,85 @@
+#ifndef PARSER_HPP
+#define PARSER_HPP
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+class Document;
+class KeyValue;
+class Part;
+class Score;
+
+// Reads the lilypond-like input syntax straight into a Document, without
+// building an intermediate tree:
+//
+//   version = 2.18.2
+//   \header { title = "Lorem Ipsum" }
+//   \setup { key = c \major }
+//   \parts {
+//     violin { name = "Violin" "Vln." relative = c'' }
+//     piano {
+//       type = PianoStaff
+//       \parts { upper { relative = c'' } lower { relative = c, } }
+//     }
+//   }
+//   \score { violin << piano >> \layout { indent = 1\cm } }
+//   \book { \score { violin } \score { piano } }
+//
+// A value runs until the end of the line (or the closing brace of the
+// block), unless it is one or more "quoted" strings. % starts a comment.
+class Parser
+{
+public:
+  Parser(Document &);
+
+  void parse_file(const std::string &path);
+  void parse(const char *data, size_t size);
+
+private:
+  struct Ref
+  {
+    const char *data;
+    size_t size;
+
+    bool operator==(const char *) const;
+    std::string str() const { return std::string(data, size); }
+  };
+
+  void parse_document();
+  void parse_key_values(KeyValue &);
+  template <class Parent> void parse_parts(Parent &);
+  void parse_part(Part &);
+  void parse_score(Score &);
+  void parse_book();
+
+  bool next_item();
+  bool next_item(char close);
+
+  Ref read_word();
+  Ref read_keyword();
+  void read_values();
+  const std::string &read_value();
+  std::string read_quoted();
+
+  void skip();
+  void skip_blanks();
+  void advance();
+  void expect(char);
+  bool at_end() const { return m_pos == m_end; }
+  char peek() const { return at_end() ? '\0' : *m_pos; }
+
+  void error(const std::string &message) const;
+  void error_at(const char *pos, const std::string &message) const;
+
+  Document &m_doc;
+
+  const char *m_begin;
+  const char *m_pos;
+  const char *m_end;
+
+  std::vector<std::string> m_values;
+  size_t m_value_count;
+};
+
+#endif
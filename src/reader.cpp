@@ -0,0 +1,860 @@
+#include "reader.hpp"
+
+#include <boost/format.hpp>
+#include <algorithm>
+#include <fstream>
+#include <unordered_set>
+#include <yaml-cpp/exceptions.h>
+#include <yaml-cpp/parser.h>
+
+#include "cache.hpp"
+#include "error.hpp"
+#include "generators.hpp"
+#include "hash.hpp"
+#include "parallel.hpp"
+#include "scalar.hpp"
+
+using namespace std;
+using format = boost::format;
+
+// A frame receives the values of the map or sequence being read. Maps get
+// their key in m_key before each value.
+class YamlReader::Frame
+{
+public:
+  Frame(const bool is_map = false) : m_is_map(is_map), m_has_key(false) {}
+  virtual ~Frame() {}
+
+  virtual void scalar(const string &) { unexpected("scalar"); }
+  virtual Frame *map() { unexpected("map"); return nullptr; }
+  virtual Frame *sequence() { unexpected("array"); return nullptr; }
+  virtual void finish() {}
+
+  // A non-zero tag if the value of the current key is a cacheable fragment,
+  // whose token is then returned by the frame reading it.
+  virtual char fragment() { return 0; }
+  virtual TokenPtr<> token() const { return nullptr; }
+
+  bool is_map() const { return m_is_map; }
+  bool has_key() const { return m_has_key; }
+  const string &key() const { return m_key; }
+
+  void set_key(const string &key) { m_key = key; m_has_key = true; }
+  void clear_key() { m_has_key = false; }
+
+protected:
+  void unexpected(const char *what) const
+  {
+    if(m_is_map)
+      throw Error(format("unexpected %s for '%s'") % what % m_key);
+    else
+      throw Error(format("unexpected %s") % what);
+  }
+
+  bool m_is_map;
+  bool m_has_key;
+  string m_key;
+};
+
+typedef YamlReader::Frame Frame;
+
+// below this, building the recorded parts serially is faster
+const size_t MIN_PARALLEL_PARTS = 64;
+
+// accepts and ignores anything
+class SkipFrame : public Frame
+{
+public:
+  SkipFrame(const bool is_map) : Frame(is_map) {}
+
+  void scalar(const string &) override {}
+  Frame *map() override { return new SkipFrame(true); }
+  Frame *sequence() override { return new SkipFrame(false); }
+};
+
+class KeyValueFrame : public Frame
+{
+public:
+  KeyValueFrame(KeyValue &block) : Frame(true), m_block(block) {}
+
+  void scalar(const string &value) override { m_block.add(m_key, value); }
+
+private:
+  KeyValue &m_block;
+};
+
+class NamesFrame : public Frame
+{
+public:
+  NamesFrame(Part &part) : m_part(part) {}
+
+  void scalar(const string &value) override { m_names.push_back(value); }
+
+  void finish() override
+  {
+    if(m_names.size() > 2) {
+      throw Error(format("expected at most two names, but got %d instead")
+        % m_names.size());
+    }
+
+    m_names.resize(2);
+    m_part.set_names(m_names[0], m_names[1]);
+  }
+
+private:
+  Part &m_part;
+  vector<string> m_names;
+};
+
+class PartFrame;
+
+template <class Parent>
+class PartsFrame : public Frame
+{
+public:
+  PartsFrame(Parent &parent) : Frame(true), m_parent(parent) {}
+
+  // empty parts
+  void scalar(const string &) override { add(); }
+
+  Frame *map() override;
+  char fragment() override;
+
+private:
+  Part add();
+
+  Parent &m_parent;
+};
+
+template <>
+Part PartsFrame<Document>::add()
+{
+  return m_parent.add_part(m_key);
+}
+
+template <>
+Part PartsFrame<Part>::add()
+{
+  return m_parent.add_sub_part(m_key);
+}
+
+// only top-level parts are cached, sub-parts belong to their parent's
+template <>
+char PartsFrame<Document>::fragment() { return 'p'; }
+
+template <>
+char PartsFrame<Part>::fragment() { return 0; }
+
+class PartFrame : public Frame
+{
+public:
+  PartFrame(const Part &part) : Frame(true), m_part(part) {}
+
+  void scalar(const string &value) override
+  {
+    switch(part_key(m_key)) {
+    case P_NAME:
+      m_part.set_names(value, value);
+      break;
+    case P_TYPE:
+      m_part.set_type(value);
+      break;
+    case P_RELATIVE:
+      m_part.set_relative(value);
+      break;
+    case P_INSTRUMENT:
+      m_part.set_instrument(value);
+      break;
+    case P_PREFIX: {
+      bool prefix;
+
+      if(!parse_bool(value, &prefix))
+        throw Error(format("invalid boolean '%s'") % value);
+
+      m_part.set_prefix(prefix);
+      break;
+    }
+    case P_PARTS:
+      break;
+    case P_INVALID:
+      throw Error(format("invalid key '%s'") % m_key);
+    }
+  }
+
+  Frame *map() override
+  {
+    switch(part_key(m_key)) {
+    case P_PARTS:
+      return new PartsFrame<Part>(m_part);
+    case P_INVALID:
+      throw Error(format("invalid key '%s'") % m_key);
+    default:
+      return Frame::map();
+    }
+  }
+
+  Frame *sequence() override
+  {
+    switch(part_key(m_key)) {
+    case P_NAME:
+      return new NamesFrame(m_part);
+    case P_INVALID:
+      throw Error(format("invalid key '%s'") % m_key);
+    default:
+      return Frame::sequence();
+    }
+  }
+
+  TokenPtr<> token() const override { return m_part.token(); }
+
+private:
+  Part m_part;
+};
+
+template <class Parent>
+Frame *PartsFrame<Parent>::map()
+{
+  return new PartFrame(add());
+}
+
+class PartRefsFrame : public Frame
+{
+public:
+  PartRefsFrame(Score &score, const bool group)
+    : m_score(score), m_group(group)
+  {
+    if(m_group)
+      m_score.begin_group();
+  }
+
+  void scalar(const string &name) override { m_score.add_part_ref(name); }
+  Frame *sequence() override { return new PartRefsFrame(m_score, true); }
+
+  void finish() override
+  {
+    if(m_group)
+      m_score.end_group();
+  }
+
+private:
+  Score &m_score;
+  bool m_group;
+};
+
+class ScoreFrame : public Frame
+{
+public:
+  ScoreFrame(const Score &score)
+    : Frame(true), m_score(score), m_has_parts(false) {}
+
+  // enables an optional block, leaving it empty
+  void scalar(const string &) override { optional_block(); }
+
+  Frame *map() override
+  {
+    if(KeyValue *block = optional_block())
+      return new KeyValueFrame(*block);
+    else
+      return new SkipFrame(true);
+  }
+
+  Frame *sequence() override
+  {
+    if(m_key == "parts") {
+      m_has_parts = true;
+      return new PartRefsFrame(m_score, false);
+    }
+    else if(optional_block())
+      return Frame::sequence();
+
+    return new SkipFrame(false);
+  }
+
+  void finish() override
+  {
+    if(!m_has_parts)
+      throw Error("score.parts must be an array");
+  }
+
+  TokenPtr<> token() const override { return m_score.token(); }
+
+private:
+  KeyValue *optional_block()
+  {
+    if(m_key == "layout")
+      return &m_score.layout();
+    else if(m_key == "midi")
+      return &m_score.midi();
+    else if(m_key == "header")
+      return &m_score.header();
+    else
+      return nullptr;
+  }
+
+  Score m_score;
+  bool m_has_parts;
+};
+
+class BookFrame : public Frame
+{
+public:
+  BookFrame(const Book &book) : m_book(book) {}
+
+  void scalar(const string &) override
+  {
+    throw Error("score.parts must be an array");
+  }
+
+  Frame *map() override { return new ScoreFrame(m_book.add_score()); }
+
+  TokenPtr<> token() const override { return m_book.token(); }
+
+private:
+  Book m_book;
+};
+
+class DocumentFrame : public Frame
+{
+public:
+  DocumentFrame(Document &doc) : Frame(true), m_doc(doc) {}
+
+  void scalar(const string &value) override
+  {
+    switch(key_type()) {
+    case D_VERSION:
+      m_doc.set_version(value);
+      break;
+    case D_GSTAFF_SIZE:
+      m_doc.set_global_staff_size(value);
+      break;
+    case D_HEADER:
+    case D_PAPER:
+    case D_SETUP:
+      throw Error("keyvalue block must be a map");
+    case D_PARTS:
+      break;
+    case D_BOOK:
+      throw Error("a book must be an array of scores");
+    case D_SCORE:
+      throw Error("score.parts must be an array");
+    case D_INVALID:
+      break;
+    }
+  }
+
+  Frame *map() override
+  {
+    switch(key_type()) {
+    case D_HEADER:
+      return new KeyValueFrame(m_doc.header());
+    case D_PAPER:
+      return new KeyValueFrame(m_doc.paper());
+    case D_SETUP:
+      return new KeyValueFrame(m_doc.setup());
+    case D_PARTS:
+      return new PartsFrame<Document>(m_doc);
+    case D_SCORE:
+      return new ScoreFrame(m_doc.add_score());
+    case D_BOOK:
+      throw Error("a book must be an array of scores");
+    default:
+      return Frame::map();
+    }
+  }
+
+  Frame *sequence() override
+  {
+    switch(key_type()) {
+    case D_BOOK:
+      return new BookFrame(m_doc.add_book());
+    case D_HEADER:
+    case D_PAPER:
+    case D_SETUP:
+      throw Error("keyvalue block must be a map");
+    case D_SCORE:
+      throw Error("score.parts must be an array");
+    default:
+      return Frame::sequence();
+    }
+  }
+
+  char fragment() override
+  {
+    switch(key_type()) {
+    case D_SCORE:
+      return 's';
+    case D_BOOK:
+      return 'b';
+    default:
+      return 0;
+    }
+  }
+
+private:
+  DocumentKey key_type() const
+  {
+    const DocumentKey type = document_key(m_key);
+
+    if(type == D_INVALID)
+      throw Error(format("invalid key '%s'") % m_key);
+
+    return type;
+  }
+
+  Document &m_doc;
+};
+
+class RootFrame : public Frame
+{
+public:
+  RootFrame(Document &doc) : m_doc(doc) {}
+
+  void scalar(const string &) override {}
+  Frame *map() override { return new DocumentFrame(m_doc); }
+
+private:
+  Document &m_doc;
+};
+
+YamlReader::YamlReader(Document &doc, const FragmentCache *cache,
+  const unsigned int jobs)
+  : m_doc(doc), m_cache(cache), m_jobs(jobs), m_replaying(false), m_depth(0)
+{
+}
+
+YamlReader::~YamlReader()
+{
+}
+
+void YamlReader::read(istream &stream)
+{
+  YAML::Parser parser(stream);
+
+  try {
+    while(parser.HandleNextDocument(*this));
+  }
+  catch(const YAML::Exception &) {
+    throw;
+  }
+  catch(const std::exception &err) {
+    throw Error(format("%d:%d: %s")
+      % (m_mark.line + 1) % (m_mark.column + 1) % err.what());
+  }
+}
+
+void YamlReader::read_file(const string &path)
+{
+  ifstream stream(path);
+
+  if(!stream)
+    throw Error(format("cannot open '%s'") % path);
+
+  read(stream);
+}
+
+void YamlReader::OnDocumentStart(const YAML::Mark &mark)
+{
+  m_mark = mark;
+  m_frames.clear();
+  m_anchors.clear();
+  m_events.clear();
+  m_pending.clear();
+  m_depth = 0;
+
+  push(new RootFrame(m_doc));
+}
+
+void YamlReader::OnDocumentEnd()
+{
+  m_frames.clear();
+}
+
+void YamlReader::OnNull(const YAML::Mark &mark, YAML::anchor_t)
+{
+  m_mark = mark;
+  scalar("null");
+}
+
+void YamlReader::OnAlias(const YAML::Mark &mark, const YAML::anchor_t anchor)
+{
+  m_mark = mark;
+
+  const auto match = m_anchors.find(anchor);
+
+  if(match == m_anchors.end())
+    throw Error("only aliases to scalars are supported");
+
+  scalar(match->second);
+}
+
+void YamlReader::OnScalar(const YAML::Mark &mark, const string &,
+  const YAML::anchor_t anchor, const string &value)
+{
+  m_mark = mark;
+
+  if(anchor)
+    m_anchors[anchor] = value;
+
+  scalar(value);
+}
+
+void YamlReader::OnSequenceStart(const YAML::Mark &mark, const string &,
+  YAML::anchor_t, YAML::EmitterStyle::value)
+{
+  m_mark = mark;
+  start(false);
+}
+
+void YamlReader::OnSequenceEnd()
+{
+  end(SequenceEndEvent);
+}
+
+void YamlReader::OnMapStart(const YAML::Mark &mark, const string &,
+  YAML::anchor_t, YAML::EmitterStyle::value)
+{
+  m_mark = mark;
+  start(true);
+}
+
+void YamlReader::OnMapEnd()
+{
+  end(MapEndEvent);
+}
+
+void YamlReader::scalar(const string &value)
+{
+  if(record(ScalarEvent, value))
+    return;
+
+  Frame *top = m_frames.back().get();
+
+  if(top->is_map() && !top->has_key())
+    top->set_key(value);
+  else {
+    if(!m_pending.empty())
+      flush_parts();
+
+    top->scalar(value);
+    top->clear_key();
+  }
+}
+
+void YamlReader::start(const bool is_map)
+{
+  const EventType type = is_map ? MapStartEvent : SequenceStartEvent;
+
+  if(record(type)) {
+    m_depth++;
+    return;
+  }
+
+  Frame *top = m_frames.back().get();
+
+  if(top->is_map() && !top->has_key())
+    throw Error("keys must be scalars");
+
+  if(!m_replaying) {
+    const char tag = top->fragment();
+
+    if(tag && (m_cache || (tag == 'p' && m_jobs > 1))) {
+      m_depth = 1;
+      record(type);
+      return;
+    }
+  }
+
+  if(!m_pending.empty())
+    flush_parts();
+
+  push(is_map ? top->map() : top->sequence());
+}
+
+void YamlReader::end(const EventType type)
+{
+  if(record(type)) {
+    if(--m_depth == 0)
+      finish_fragment();
+
+    return;
+  }
+
+  pop();
+}
+
+void YamlReader::push(Frame *frame)
+{
+  m_frames.emplace_back(frame);
+}
+
+void YamlReader::pop()
+{
+  if(!m_pending.empty())
+    flush_parts();
+
+  m_frames.back()->finish();
+  m_frames.pop_back();
+
+  // the collection that ended was the value of the parent's current key
+  m_frames.back()->clear_key();
+}
+
+bool YamlReader::record(const EventType type, const string &value)
+{
+  if(!m_depth)
+    return false;
+
+  m_events.push_back({type, value, m_mark});
+  return true;
+}
+
+static uint64_t hash_field(const string &value, uint64_t hash)
+{
+  const uint64_t size = value.size();
+  hash = hash_bytes((const char *)&size, sizeof(size), hash);
+
+  return hash_string(value, hash);
+}
+
+// keeps the first identifier used for each name, in order
+static void unique_names(IdentifierMap::Entries *entries)
+{
+  unordered_set<string> seen;
+
+  entries->erase(remove_if(entries->begin(), entries->end(),
+    [&](const IdentifierMap::Entries::value_type &entry) {
+      return !seen.insert(entry.first).second;
+    }), entries->end());
+}
+
+void YamlReader::finish_fragment()
+{
+  Frame *top = m_frames.back().get();
+
+  const char tag = top->fragment();
+  uint64_t key = 0;
+
+  if(m_cache) {
+    key = hash_bytes(&tag, sizeof(tag));
+    key = hash_field(top->key(), key);
+
+    for(const Event &event : m_events) {
+      const char type = event.type;
+      key = hash_bytes(&type, sizeof(type), key);
+      key = hash_field(event.value, key);
+    }
+  }
+
+  if(tag == 'p' && m_jobs > 1) {
+    m_pending.push_back({top->key(), key, {}, false, {}, nullptr});
+
+    PendingPart &part = m_pending.back();
+    part.events.swap(m_events);
+    part.cached = m_cache && m_cache->load(key, &part.fragment);
+
+    top->clear_key();
+
+    // bounds the recorded events kept in memory
+    if(m_pending.size() >= MIN_PARALLEL_PARTS * m_jobs)
+      flush_parts();
+
+    return;
+  }
+
+  IdentifierMap &identifiers = m_doc.identifiers();
+  FragmentCache::Fragment fragment;
+
+  if(m_cache && m_cache->load(key, &fragment) &&
+      identifiers.restore(fragment.identifiers)) {
+    // the identifiers used by scores are those of the parts they reference
+    vector<string> names;
+
+    for(const auto &entry : fragment.identifiers)
+      names.push_back(entry.first);
+
+    switch(tag) {
+    case 's':
+      m_doc.add_unit_code(Document::ScoreUnit, fragment.code,
+        fragment.compact_code, names);
+      break;
+    case 'b':
+      m_doc.add_unit_code(Document::BookUnit, fragment.code,
+        fragment.compact_code, names);
+      break;
+    default:
+      m_doc.add_part_code(top->key(), fragment.code, fragment.compact_code);
+    }
+
+    top->clear_key();
+    m_events.clear();
+    return;
+  }
+
+  vector<Event> events;
+  events.swap(m_events);
+
+  replay(events, key);
+}
+
+// builds the fragment from the recorded events as usual
+void YamlReader::replay(const vector<Event> &events, const uint64_t key)
+{
+  IdentifierMap &identifiers = m_doc.identifiers();
+  FragmentCache::Fragment fragment;
+
+  if(m_cache)
+    identifiers.set_log(&fragment.identifiers);
+
+  m_replaying = true;
+
+  TokenPtr<> token;
+
+  try {
+    for(const Event &event : events) {
+      m_mark = event.mark;
+
+      switch(event.type) {
+      case ScalarEvent:
+        scalar(event.value);
+        break;
+      case MapStartEvent:
+      case SequenceStartEvent:
+        start(event.type == MapStartEvent);
+
+        if(!token)
+          token = m_frames.back()->token();
+        break;
+      case MapEndEvent:
+      case SequenceEndEvent:
+        pop();
+        break;
+      }
+    }
+  }
+  catch(...) {
+    identifiers.set_log(nullptr);
+    m_replaying = false;
+    throw;
+  }
+
+  identifiers.set_log(nullptr);
+  m_replaying = false;
+
+  if(m_cache) {
+    unique_names(&fragment.identifiers);
+    m_cache->render(token, &fragment);
+    m_cache->store(key, fragment);
+  }
+}
+
+void YamlReader::build_part(Part &part, const vector<Event> &events)
+{
+  // let the serial path report values that are not maps
+  if(events.front().type != MapStartEvent)
+    throw Error("unexpected value");
+
+  vector<unique_ptr<Frame> > frames;
+  frames.emplace_back(new PartFrame(part));
+
+  // the first and last events open and close the part itself
+  for(size_t i = 1; i + 1 < events.size(); i++) {
+    const Event &event = events[i];
+    Frame *top = frames.back().get();
+
+    switch(event.type) {
+    case ScalarEvent:
+      if(top->is_map() && !top->has_key())
+        top->set_key(event.value);
+      else {
+        top->scalar(event.value);
+        top->clear_key();
+      }
+      break;
+    case MapStartEvent:
+    case SequenceStartEvent:
+      if(top->is_map() && !top->has_key())
+        throw Error("keys must be scalars");
+
+      frames.emplace_back(event.type == MapStartEvent ?
+        top->map() : top->sequence());
+      break;
+    case MapEndEvent:
+    case SequenceEndEvent:
+      top->finish();
+      frames.pop_back();
+      frames.back()->clear_key();
+      break;
+    }
+  }
+
+  frames.back()->finish();
+}
+
+// Builds the recorded parts on worker threads, each with its own context,
+// then adds them to the document in order. A part is built again serially
+// if the identifiers a worker gave it differ from the ones it would get
+// in order, so that the output is the same as without workers.
+void YamlReader::flush_parts()
+{
+  vector<PendingPart> parts;
+  parts.swap(m_pending);
+
+  vector<PendingPart *> todo;
+
+  for(PendingPart &part : parts) {
+    if(!part.cached)
+      todo.push_back(&part);
+  }
+
+  if(todo.size() >= MIN_PARALLEL_PARTS) {
+    const size_t chunks = min<size_t>(m_jobs, todo.size());
+    vector<Context *> contexts;
+
+    for(size_t i = 0; i < chunks; i++)
+      contexts.push_back(&m_doc.add_context());
+
+    parallel_for(chunks, m_jobs, [&](size_t chunk) {
+      Context &context = *contexts[chunk];
+
+      const size_t begin = chunk * todo.size() / chunks;
+      const size_t end = (chunk + 1) * todo.size() / chunks;
+
+      for(size_t i = begin; i < end; i++) {
+        PendingPart &part = *todo[i];
+        context.identifiers().set_log(&part.fragment.identifiers);
+
+        // errors are reported when building the part again serially
+        try {
+          Part built(part.name, context);
+          build_part(built, part.events);
+          part.token = built.token();
+        }
+        catch(const std::exception &) {}
+
+        context.identifiers().set_log(nullptr);
+        unique_names(&part.fragment.identifiers);
+      }
+    });
+  }
+
+  IdentifierMap &identifiers = m_doc.identifiers();
+  Frame *top = m_frames.back().get();
+
+  for(PendingPart &part : parts) {
+    if(part.cached && identifiers.restore(part.fragment.identifiers))
+      m_doc.add_part_code(part.name, part.fragment.code,
+        part.fragment.compact_code);
+    else if(part.token && identifiers.restore(part.fragment.identifiers)) {
+      m_doc.add_part_token(part.name, part.token);
+
+      if(m_cache) {
+        m_cache->render(part.token, &part.fragment);
+        m_cache->store(part.key, part.fragment);
+      }
+    }
+    else {
+      top->set_key(part.name);
+      replay(part.events, part.key);
+    }
+  }
+}
@@ -0,0 +1,104 @@
+#ifndef READER_HPP
+#define READER_HPP
+
+#include <istream>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+#include <yaml-cpp/eventhandler.h>
+#include <yaml-cpp/mark.h>
+
+#include "cache.hpp"
+#include "tokens.hpp"
+
+class Document;
+class Part;
+
+// Builds a Document from yaml-cpp's parser events as they arrive, instead
+// of loading the whole YAML::Node tree first. Produces the same output as
+// Document::read_yaml.
+//
+// With a cache, the events of each part, score and book are recorded first
+// and the fragment rendered by a previous run is reused if they match.
+//
+// With several jobs, the top-level parts are recorded too and built in
+// parallel once their map ends.
+class YamlReader : public YAML::EventHandler
+{
+public:
+  class Frame;
+
+  YamlReader(Document &, const FragmentCache *cache = nullptr,
+    unsigned int jobs = 1);
+  ~YamlReader();
+
+  void read(std::istream &);
+  void read_file(const std::string &path);
+
+  void OnDocumentStart(const YAML::Mark &) override;
+  void OnDocumentEnd() override;
+
+  void OnNull(const YAML::Mark &, YAML::anchor_t) override;
+  void OnAlias(const YAML::Mark &, YAML::anchor_t) override;
+  void OnScalar(const YAML::Mark &, const std::string &tag,
+    YAML::anchor_t, const std::string &value) override;
+
+  void OnSequenceStart(const YAML::Mark &, const std::string &tag,
+    YAML::anchor_t, YAML::EmitterStyle::value) override;
+  void OnSequenceEnd() override;
+
+  void OnMapStart(const YAML::Mark &, const std::string &tag,
+    YAML::anchor_t, YAML::EmitterStyle::value) override;
+  void OnMapEnd() override;
+
+private:
+  enum EventType { ScalarEvent, MapStartEvent, MapEndEvent,
+    SequenceStartEvent, SequenceEndEvent };
+
+  struct Event
+  {
+    EventType type;
+    std::string value;
+    YAML::Mark mark;
+  };
+
+  void scalar(const std::string &);
+  void start(bool is_map);
+  void end(EventType);
+  void push(Frame *);
+  void pop();
+
+  struct PendingPart
+  {
+    std::string name;
+    uint64_t key;
+    std::vector<Event> events;
+
+    // a cached fragment, or the identifiers used by the worker
+    bool cached;
+    FragmentCache::Fragment fragment;
+
+    TokenPtr<> token; // built by a worker, null if it failed
+  };
+
+  bool record(EventType, const std::string &value = std::string());
+  void finish_fragment();
+  void replay(const std::vector<Event> &, uint64_t key);
+  void flush_parts();
+
+  static void build_part(Part &, const std::vector<Event> &);
+
+  Document &m_doc;
+  const FragmentCache *m_cache;
+  unsigned int m_jobs;
+  bool m_replaying;
+  unsigned int m_depth;
+  std::vector<Event> m_events;
+  std::vector<PendingPart> m_pending;
+  std::vector<std::unique_ptr<Frame> > m_frames;
+  std::map<YAML::anchor_t, std::string> m_anchors;
+  YAML::Mark m_mark;
+};
+
+#endif
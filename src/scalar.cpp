@@ -0,0 +1,157 @@
+#include "scalar.hpp"
+
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <limits>
+
+using namespace std;
+
+static bool is_lower(const char c) { return c >= 'a' && c <= 'z'; }
+static bool is_upper(const char c) { return c >= 'A' && c <= 'Z'; }
+static bool is_digit(const char c) { return c >= '0' && c <= '9'; }
+
+static bool is_space(const char c)
+{
+  return c == ' ' || (c >= '\t' && c <= '\r');
+}
+
+// yaml-cpp only accepts "lowercase", "UPPERCASE" and "Capitalized" words
+static bool is_flexible_case(const string &str)
+{
+  if(str.empty())
+    return true;
+
+  bool all_lower = true, rest_lower = true, rest_upper = true;
+
+  for(size_t i = 0; i < str.size(); i++) {
+    all_lower = all_lower && is_lower(str[i]);
+
+    if(i > 0) {
+      rest_lower = rest_lower && is_lower(str[i]);
+      rest_upper = rest_upper && is_upper(str[i]);
+    }
+  }
+
+  return all_lower || (is_upper(str[0]) && (rest_lower || rest_upper));
+}
+
+static bool equals_lower(const string &str, const char *word)
+{
+  const size_t size = strlen(word);
+
+  if(str.size() != size)
+    return false;
+
+  for(size_t i = 0; i < size; i++) {
+    const char c = is_upper(str[i]) ? str[i] - 'A' + 'a' : str[i];
+
+    if(c != word[i])
+      return false;
+  }
+
+  return true;
+}
+
+bool parse_bool(const string &str, bool *value)
+{
+  static const char *const NAMES[][2] = {
+    {"y", "n"}, {"yes", "no"}, {"true", "false"}, {"on", "off"},
+  };
+
+  if(str.size() > 5 || !is_flexible_case(str))
+    return false;
+
+  for(const auto &name : NAMES) {
+    if(equals_lower(str, name[0])) {
+      *value = true;
+      return true;
+    }
+    else if(equals_lower(str, name[1])) {
+      *value = false;
+      return true;
+    }
+  }
+
+  return false;
+}
+
+bool parse_double(const string &str, double *value)
+{
+  // what std::istream >> double would extract (digits with an optional sign,
+  // decimal point and exponent)
+  size_t end = 0;
+  bool mantissa = false;
+
+  if(end < str.size() && (str[end] == '+' || str[end] == '-'))
+    end++;
+
+  while(end < str.size() && is_digit(str[end]))
+    end++, mantissa = true;
+
+  if(end < str.size() && str[end] == '.') {
+    end++;
+
+    while(end < str.size() && is_digit(str[end]))
+      end++, mantissa = true;
+  }
+
+  if(mantissa && end < str.size() && (str[end] == 'e' || str[end] == 'E')) {
+    end++;
+
+    if(end < str.size() && (str[end] == '+' || str[end] == '-'))
+      end++;
+
+    while(end < str.size() && is_digit(str[end]))
+      end++;
+  }
+
+  bool valid = true;
+
+  for(size_t i = end; i < str.size(); i++)
+    valid = valid && is_space(str[i]);
+
+  if(valid && end > 0) {
+    char *parsed;
+    const double number = strtod(str.c_str(), &parsed);
+
+    if(parsed == str.c_str() + end && !std::isinf(number)) {
+      *value = number;
+      return true;
+    }
+  }
+
+  if(str == ".inf" || str == ".Inf" || str == ".INF" ||
+      str == "+.inf" || str == "+.Inf" || str == "+.INF") {
+    *value = numeric_limits<double>::infinity();
+    return true;
+  }
+  else if(str == "-.inf" || str == "-.Inf" || str == "-.INF") {
+    *value = -numeric_limits<double>::infinity();
+    return true;
+  }
+  else if(str == ".nan" || str == ".NaN" || str == ".NAN") {
+    *value = numeric_limits<double>::quiet_NaN();
+    return true;
+  }
+
+  return false;
+}
+
+ScalarType classify_scalar(const string &str, bool *boolean)
+{
+  bool dummy;
+
+  if(parse_bool(str, boolean ? boolean : &dummy))
+    return BooleanScalar;
+
+  if(str.find('\\') != string::npos || str.find('#') == 0)
+    return LiteralScalar;
+
+  // zero is a string (so is anything that is not a number)
+  double number;
+  if(parse_double(str, &number) && number)
+    return LiteralScalar;
+
+  return StringScalar;
+}
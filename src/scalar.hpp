@@ -0,0 +1,17 @@
+#ifndef SCALAR_HPP
+#define SCALAR_HPP
+
+#include <string>
+
+enum ScalarType { BooleanScalar, LiteralScalar, StringScalar };
+
+// Same conversions as yaml-cpp's as<bool>() and as<double>(), without
+// throwing on failure.
+bool parse_bool(const std::string &, bool *value);
+bool parse_double(const std::string &, double *value);
+
+// Decides which token type represents a scalar value: booleans, then
+// lilypond/scheme expressions and non-zero numbers, then strings.
+ScalarType classify_scalar(const std::string &, bool *boolean = nullptr);
+
+#endif
@@ -0,0 +1,114 @@
+#include "scan.hpp"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define SCAN_X86
+#endif
+
+static const char *find_scalar(const char *it, const char *end)
+{
+  for(; it != end; it++) {
+    if(*it == '"' || *it == '\n')
+      break;
+  }
+
+  return it;
+}
+
+#if defined(SCAN_X86) && defined(__SSE2__)
+static const char *find_sse2(const char *it, const char *end)
+{
+  const __m128i quote = _mm_set1_epi8('"');
+  const __m128i newline = _mm_set1_epi8('\n');
+
+  for(; end - it >= 16; it += 16) {
+    const __m128i chunk = _mm_loadu_si128(
+      reinterpret_cast<const __m128i *>(it));
+
+    const int mask = _mm_movemask_epi8(_mm_or_si128(
+      _mm_cmpeq_epi8(chunk, quote), _mm_cmpeq_epi8(chunk, newline)));
+
+    if(mask)
+      return it + __builtin_ctz(mask);
+  }
+
+  return find_scalar(it, end);
+}
+
+__attribute__((target("avx2")))
+static const char *find_avx2(const char *it, const char *end)
+{
+  const __m256i quote = _mm256_set1_epi8('"');
+  const __m256i newline = _mm256_set1_epi8('\n');
+
+  for(; end - it >= 32; it += 32) {
+    const __m256i chunk = _mm256_loadu_si256(
+      reinterpret_cast<const __m256i *>(it));
+
+    const unsigned int mask = _mm256_movemask_epi8(_mm256_or_si256(
+      _mm256_cmpeq_epi8(chunk, quote), _mm256_cmpeq_epi8(chunk, newline)));
+
+    if(mask)
+      return it + __builtin_ctz(mask);
+  }
+
+  return find_sse2(it, end);
+}
+
+ScanFunction sse2_scan()
+{
+  return find_sse2;
+}
+
+ScanFunction avx2_scan()
+{
+  __builtin_cpu_init();
+  return __builtin_cpu_supports("avx2") ? find_avx2 : nullptr;
+}
+#else
+ScanFunction sse2_scan()
+{
+  return nullptr;
+}
+
+ScanFunction avx2_scan()
+{
+  return nullptr;
+}
+#endif
+
+ScanFunction scalar_scan()
+{
+  return find_scalar;
+}
+
+static ScanFunction best_scan()
+{
+  if(const ScanFunction avx2 = avx2_scan())
+    return avx2;
+  else if(const ScanFunction sse2 = sse2_scan())
+    return sse2;
+  else
+    return find_scalar;
+}
+
+const char *find_quote_or_newline(const char *begin, const char *end)
+{
+  static const ScanFunction scan = best_scan();
+
+  // too short for the vector loops
+  if(end - begin < 16)
+    return find_scalar(begin, end);
+
+  return scan(begin, end);
+}
+
+const char *scan_kernel()
+{
+  if(avx2_scan())
+    return "avx2";
+  else if(sse2_scan())
+    return "sse2";
+  else
+    return "scalar";
+}
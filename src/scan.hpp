@@ -0,0 +1,19 @@
+#ifndef SCAN_HPP
+#define SCAN_HPP
+
+// Returns the first double quote or newline in [begin, end), or end. Uses
+// the widest vector instructions the CPU supports.
+const char *find_quote_or_newline(const char *begin, const char *end);
+
+// Name of the implementation picked by find_quote_or_newline.
+const char *scan_kernel();
+
+// The implementations, for testing and benchmarking. Those the build or the
+// CPU does not support are null.
+typedef const char *(*ScanFunction)(const char *, const char *);
+
+ScanFunction scalar_scan();
+ScanFunction sse2_scan();
+ScanFunction avx2_scan();
+
+#endif
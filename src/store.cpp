@@ -0,0 +1,153 @@
+#include "store.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <boost/format.hpp>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+#include "error.hpp"
+#include "output.hpp"
+
+using namespace std;
+using format = boost::format;
+
+const string SOURCE_EXTENSION = "ly";
+
+static bool copy_file(const string &from, const string &to)
+{
+  string content;
+
+  if(!read_file(from, &content))
+    return false;
+
+  ofstream stream(to, ios::binary);
+  stream << content;
+
+  return stream.good();
+}
+
+static void remove_directory(const string &path)
+{
+  for(const string &name : list_directory(path))
+    unlink((path + "/" + name).c_str());
+
+  rmdir(path.c_str());
+}
+
+ResultStore::ResultStore(const string &directory, const uint64_t max_size)
+  : m_directory(directory), m_max_size(max_size)
+{
+  make_directory(directory);
+}
+
+string ResultStore::path(const uint64_t key) const
+{
+  return (format("%s/%016x") % m_directory % key).str();
+}
+
+bool ResultStore::restore(const uint64_t key, const string &directory,
+  const string &name) const
+{
+  const string entry = path(key);
+  const vector<string> files = list_directory(entry);
+
+  if(files.empty())
+    return false;
+
+  for(const string &extension : files) {
+    string content;
+
+    if(!read_file(entry + "/" + extension, &content))
+      return false;
+
+    // unchanged outputs keep their modification time
+    write_if_changed(directory + "/" + name + "." + extension, content);
+  }
+
+  // the modification time of an entry is its last use
+  utimes(entry.c_str(), nullptr);
+
+  return true;
+}
+
+void ResultStore::store(const uint64_t key, const string &directory,
+  const string &name) const
+{
+  static atomic<unsigned int> counter(0);
+
+  const string entry = path(key);
+  const string temp = (format("%s.%d.%d.tmp")
+    % entry % getpid() % counter++).str();
+
+  if(mkdir(temp.c_str(), 0777))
+    return;
+
+  const string prefix = name + ".";
+  bool ok = true;
+
+  for(const string &file : list_directory(directory)) {
+    if(file.compare(0, prefix.size(), prefix) != 0)
+      continue;
+
+    const string extension = file.substr(prefix.size());
+
+    if(extension != SOURCE_EXTENSION) {
+      ok = copy_file(directory + "/" + file, temp + "/" + extension) && ok;
+    }
+  }
+
+  // entries appear complete or not at all; an existing one is as good
+  if(!ok || rename(temp.c_str(), entry.c_str()))
+    remove_directory(temp);
+}
+
+void ResultStore::evict() const
+{
+  struct Entry
+  {
+    string path;
+    time_t used;
+    uint64_t size;
+  };
+
+  vector<Entry> entries;
+  uint64_t total = 0;
+
+  for(const string &name : list_directory(m_directory)) {
+    const string entry = m_directory + "/" + name;
+    struct stat info;
+
+    if(name.find('.') != string::npos || stat(entry.c_str(), &info))
+      continue;
+
+    uint64_t size = 0;
+
+    for(const string &file : list_directory(entry)) {
+      struct stat file_info;
+
+      if(!stat((entry + "/" + file).c_str(), &file_info))
+        size += file_info.st_size;
+    }
+
+    entries.push_back({entry, info.st_mtime, size});
+    total += size;
+  }
+
+  sort(entries.begin(), entries.end(), [](const Entry &a, const Entry &b) {
+    return a.used < b.used;
+  });
+
+  for(const Entry &entry : entries) {
+    if(total <= m_max_size)
+      break;
+
+    remove_directory(entry.path);
+    total -= entry.size;
+  }
+}
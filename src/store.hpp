@@ -0,0 +1,34 @@
+#ifndef STORE_HPP
+#define STORE_HPP
+
+#include <cstdint>
+#include <string>
+
+// Content-addressed store of compiler outputs. Each entry holds the files
+// produced for a job (PDF, MIDI, log...) under the hash of everything the
+// job depended on. The least recently used entries are evicted once the
+// store grows past its size limit.
+class ResultStore
+{
+public:
+  ResultStore(const std::string &directory, uint64_t max_size);
+
+  // Copies the files stored under key to directory/name.<extension>.
+  bool restore(uint64_t key, const std::string &directory,
+    const std::string &name) const;
+
+  // Stores the files named directory/name.<extension>, except the source.
+  void store(uint64_t key, const std::string &directory,
+    const std::string &name) const;
+
+  // Removes the least recently used entries until the store fits.
+  void evict() const;
+
+private:
+  std::string path(uint64_t key) const;
+
+  std::string m_directory;
+  uint64_t m_max_size;
+};
+
+#endif
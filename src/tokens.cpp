@@ -1,137 +1,527 @@
 #include "tokens.hpp"
 
-#include <boost/algorithm/string/replace.hpp>
+#include "parallel.hpp"
+#include "scan.hpp"
+
+#include <algorithm>
+#include <cstring>
 #include <sstream>
+#include <typeinfo>
 
-using namespace boost;
 using namespace std;
 
-typedef stringstream sstream;
-
-const string NL = "\n";
-const string SP = "\x20";
+const char NL = '\n';
+const char SP = '\x20';
 
-const string LEVEL = SP+SP;
+const string LEVEL = "\x20\x20";
 const string COMMENT = "% ";
 
-std::ostream &operator<<(ostream &stream, const TokenPtr<> token)
+// chunks per thread, evening out subtrees of different sizes
+const size_t CHUNKS_PER_JOB = 4;
+
+static int parallel_index()
+{
+  static const int index = ios_base::xalloc();
+  return index;
+}
+
+static int no_memo_index()
+{
+  static const int index = ios_base::xalloc();
+  return index;
+}
+
+static int compact_index()
+{
+  static const int index = ios_base::xalloc();
+  return index;
+}
+
+void set_parallel(ostream &stream, const ParallelWrite *settings)
 {
-  stream << token->code();
+  stream.pword(parallel_index()) = const_cast<ParallelWrite *>(settings);
+}
+
+void set_memo(ostream &stream, const bool enable)
+{
+  stream.iword(no_memo_index()) = !enable;
+}
+
+void set_compact(ostream &stream, const bool enable)
+{
+  stream.iword(compact_index()) = enable;
+}
+
+bool is_compact(ostream &stream)
+{
+  return stream.iword(compact_index()) != 0;
+}
+
+static bool memo_enabled(ostream &stream)
+{
+  return !stream.iword(no_memo_index());
+}
+
+std::ostream &operator<<(ostream &stream, const TokenPtr<> &token)
+{
+  token->write(stream);
   return stream;
 }
 
 Token &operator<<(Token &parent, TokenPtr<> child)
 {
-  parent.m_children.push_back(child);
+  parent.adopt(child);
+  parent.m_children.push_back(std::move(child));
+  parent.changed();
   return parent;
 }
 
-string Token::code() const
+Token::~Token()
 {
-  sstream ss;
+  for(const TokenPtr<> &child : m_children)
+    release(child);
+}
 
-  for(auto it = children().begin(); it != children().end(); it++) {
-    if((*it)->empty())
-      continue;
+void Token::clear()
+{
+  for(const TokenPtr<> &child : m_children)
+    release(child);
+
+  m_children.clear();
+  changed();
+}
+
+void Token::changed()
+{
+  discard_code();
 
-    ss << *it << NL;
+  if(m_parent)
+    m_parent->changed();
 
-    if(it + 1 != children().end())
-      ss << NL;
+  if(m_more_parents) {
+    for(Token *parent : *m_more_parents)
+      parent->changed();
   }
+}
 
-  return ss.str();
+void Token::adopt(const TokenPtr<> &child)
+{
+  if(!m_view && !child->m_shared)
+    child->add_parent(this);
 }
 
-string Command::code() const
+void Token::release(const TokenPtr<> &child)
 {
-  sstream ss;
-  ss << "\\" << m_name;
+  // the arena children of a dying arena token may be gone already, those
+  // it owns through a control block are still alive
+  if(!m_view && (!m_detached || child.use_count() > 0) && !child->m_shared)
+    child->remove_parent(this);
+}
 
-  for(const TokenPtr<> child : children()) {
-    if(!child->empty())
-      ss << SP << child;
+void Token::add_parent(Token *parent)
+{
+  if(!m_parent)
+    m_parent = parent;
+  else {
+    if(!m_more_parents)
+      m_more_parents.reset(new vector<Token *>);
+
+    m_more_parents->push_back(parent);
   }
+}
 
+void Token::remove_parent(Token *parent)
+{
+  if(m_parent == parent)
+    m_parent = nullptr;
+  else if(m_more_parents) {
+    const auto it = find(m_more_parents->begin(), m_more_parents->end(),
+      parent);
+
+    if(it != m_more_parents->end())
+      m_more_parents->erase(it);
+  }
+}
+
+bool Token::omitted(const TokenPtr<> &child, const bool compact)
+{
+  return child->empty() || (compact && child->shape().kind == CommentKind);
+}
+
+void Token::newline(ostream &stream, const unsigned int level)
+{
+  // a newline followed by the indentation of the deepest usual levels
+  static const string INDENT = NL + string(64, SP);
+  static const unsigned int MAX_LEVEL = (INDENT.size() - 1) / LEVEL.size();
+
+  if(level <= MAX_LEVEL) {
+    stream.write(INDENT.data(), 1 + level * LEVEL.size());
+    return;
+  }
+
+  stream.write(INDENT.data(), INDENT.size());
+
+  for(unsigned int i = MAX_LEVEL; i < level; i++)
+    stream << LEVEL;
+}
+
+void Token::write_text(ostream &stream, const string &text,
+  const unsigned int level)
+{
+  write_text(stream, text.data(), text.size(), level);
+}
+
+void Token::write_text(ostream &stream, const char *text, const size_t size,
+  const unsigned int level)
+{
+  const char *end = text + size, *nl;
+
+  if(is_compact(stream)) {
+    stream.write(text, size);
+
+    // a line comment would swallow the code following on the same line
+    const char *line = end;
+
+    while(line != text && line[-1] != NL)
+      line--;
+
+    if(memchr(line, '%', end - line))
+      stream.put(NL);
+
+    return;
+  }
+
+  while((nl = static_cast<const char *>(memchr(text, NL, end - text)))) {
+    stream.write(text, nl - text);
+    newline(stream, level);
+    text = nl + 1;
+  }
+
+  stream.write(text, end - text);
+}
+
+void Token::write_string(ostream &stream, const char *text,
+  const size_t size, const unsigned int level)
+{
+  stream.put('"');
+
+  const char *end = text + size, *it;
+  const unsigned int indent = is_compact(stream) ? 0 : level;
+
+  while((it = find_quote_or_newline(text, end)) != end) {
+    stream.write(text, it - text);
+
+    if(*it == NL)
+      newline(stream, indent);
+    else
+      stream << "\\\"";
+
+    text = it + 1;
+  }
+
+  stream.write(text, end - text);
+  stream.put('"');
+}
+
+void Token::write_comment(ostream &stream, const char *text,
+  const size_t size, const bool decorate, const unsigned int level)
+{
+  if(is_compact(stream))
+    return;
+
+  const string decoration =
+    decorate ? string(COMMENT.rbegin(), COMMENT.rend()) : "";
+
+  stream << COMMENT;
+
+  const char *end = text + size, *nl;
+
+  while((nl = static_cast<const char *>(memchr(text, NL, end - text)))) {
+    stream.write(text, nl - text);
+    stream << decoration;
+    newline(stream, level);
+    stream << COMMENT;
+    text = nl + 1;
+  }
+
+  stream.write(text, end - text);
+  stream << decoration;
+}
+
+Token::Shape Token::shape() const
+{
+  const Kind kind =
+    typeid(*this) == typeid(Token) ? SequenceKind : ForeignKind;
+
+  return {kind, nullptr, false, nullptr};
+}
+
+bool Token::write_parallel(ostream &stream,
+  const function<void(ostream &, size_t)> &func) const
+{
+  const size_t count = m_children.size();
+  const ParallelWrite *settings =
+    static_cast<const ParallelWrite *>(stream.pword(parallel_index()));
+
+  if(!settings || settings->jobs < 2 || count < 2
+      || count < settings->threshold)
+    return false;
+
+  const size_t chunks = min(count, settings->jobs * CHUNKS_PER_JOB);
+  vector<string> buffers(chunks);
+
+  parallel_for(chunks, settings->jobs, [&](const size_t chunk) {
+    ostringstream buffer;
+    buffer.copyfmt(stream);
+
+    // nested tokens render serially on this thread, and without caching
+    // since the same block may be written by two threads at once
+    set_parallel(buffer, nullptr);
+    set_memo(buffer, false);
+
+    const size_t end = count * (chunk + 1) / chunks;
+    for(size_t i = count * chunk / chunks; i < end; i++)
+      func(buffer, i);
+
+    buffers[chunk] = buffer.str();
+  });
+
+  for(const string &buffer : buffers)
+    stream.write(buffer.data(), buffer.size());
+
+  return true;
+}
+
+string Token::code() const
+{
+  ostringstream ss;
+  write(ss);
   return ss.str();
 }
 
-string Block::code() const
+void Token::write(ostream &stream, const unsigned int level) const
+{
+  const bool compact = is_compact(stream);
+
+  auto write_child = [&](ostream &out, const size_t i) {
+    const TokenPtr<> &child = children()[i];
+
+    if(omitted(child, compact))
+      return;
+
+    child->write(out, level);
+
+    if(compact) {
+      out.put(NL);
+      return;
+    }
+
+    newline(out, level);
+
+    if(i + 1 != children().size())
+      newline(out, level);
+  };
+
+  if(write_parallel(stream, write_child))
+    return;
+
+  for(size_t i = 0; i < children().size(); i++)
+    write_child(stream, i);
+}
+
+void Command::write(ostream &stream, const unsigned int level) const
+{
+  stream << "\\" << m_name;
+
+  const bool compact = is_compact(stream);
+
+  for(const TokenPtr<> &child : children()) {
+    if(omitted(child, compact))
+      continue;
+
+    stream.put(SP);
+    child->write(stream, level);
+  }
+}
+
+void Block::write(ostream &stream, const unsigned int level) const
+{
+  if(!memo_enabled(stream)) {
+    write_code(stream, level);
+    return;
+  }
+
+  const bool compact = is_compact(stream);
+
+  if(!m_cached || m_code_level != level || m_code_compact != compact) {
+    // only the outermost blocks cache their code, their nested blocks are
+    // written into a buffer reused by the next ones
+    static thread_local ostringstream buffer;
+    buffer.str(string());
+    buffer.copyfmt(stream);
+    set_memo(buffer, false);
+
+    write_code(buffer, level);
+
+    m_code = buffer.str();
+    m_code_level = level;
+    m_code_compact = compact;
+    m_cached = true;
+  }
+
+  stream.write(m_code.data(), m_code.size());
+}
+
+void Block::discard_code()
 {
-  sstream ss;
+  if(m_cached) {
+    string().swap(m_code);
+    m_cached = false;
+  }
+}
 
+void Block::write_code(ostream &stream, const unsigned int level) const
+{
   switch(m_type) {
   case BraceStyle:
-    ss << "{";
+    stream << "{";
     break;
   case BracketStyle:
-    ss << "<<";
+    stream << "<<";
     break;
   }
 
-  bool first_nl = false;
+  const bool compact = is_compact(stream);
+  const bool has_content = any_of(children().begin(), children().end(),
+    [&](const TokenPtr<> &child) { return !omitted(child, compact); });
 
-  for(const TokenPtr<> child : children()) {
-    if(child->empty())
-      continue;
+  if(has_content && !compact)
+    newline(stream, level);
+
+  auto write_child = [&](ostream &out, const size_t i) {
+    const TokenPtr<> &child = children()[i];
 
-    if(!first_nl) {
-      ss << NL;
-      first_nl = true;
+    if(omitted(child, compact))
+      return;
+
+    // the spaces keep the brackets apart from the code of literals
+    if(compact) {
+      out.put(SP);
+      child->write(out, level + 1);
+      return;
     }
 
-    ss << LEVEL << replace_all_copy(child->code(), NL, NL + LEVEL) << NL;
+    out << LEVEL;
+    child->write(out, level + 1);
+    newline(out, level);
+  };
+
+  if(!write_parallel(stream, write_child)) {
+    for(size_t i = 0; i < children().size(); i++)
+      write_child(stream, i);
   }
 
+  if(has_content && compact)
+    stream.put(SP);
+
   switch(m_type) {
   case BraceStyle:
-    ss << "}";
+    stream << "}";
     break;
   case BracketStyle:
-    ss << ">>";
+    stream << ">>";
     break;
   }
+}
 
-  return ss.str();
+void Variable::changeValue(TokenPtr<> val)
+{
+  release(m_value);
+  m_value = std::move(val);
+  adopt(m_value);
+  changed();
 }
 
-string Variable::code() const
+void Variable::write(ostream &stream, const unsigned int level) const
 {
-  return m_name + " = " + m_value->code();
+  stream << m_name << " = ";
+  m_value->write(stream, level);
 }
 
-string Boolean::code() const
+void Boolean::write(ostream &stream, const unsigned int) const
 {
-  return m_value ? "##t" : "##f";
+  stream << (m_value ? "##t" : "##f");
 }
 
-string String::code() const
+void String::write(ostream &stream, const unsigned int level) const
 {
-  return "\"" + replace_all_copy(m_value, "\"", "\\\"") + "\"";
+  write_string(stream, m_value.data(), m_value.size(), level);
 }
 
-string Literal::code() const
+void Literal::write(ostream &stream, const unsigned int level) const
 {
-  return m_value;
+  write_text(stream, m_value, level);
 }
 
-string Function::code() const
+void RenderedCode::write(ostream &stream, const unsigned int level) const
 {
-  sstream ss;
-  ss << "#(" << m_name;
+  write_text(stream, is_compact(stream) ? m_compact_code : m_code, level);
+}
 
-  for(const TokenPtr<> child : children())
-    ss << SP << child;
+void Function::write(ostream &stream, const unsigned int level) const
+{
+  stream << "#(" << m_name;
 
-  ss << ")";
-  return ss.str();
+  for(const TokenPtr<> &child : children()) {
+    stream.put(SP);
+    child->write(stream, level);
+  }
+
+  stream << ")";
 }
 
-string Comment::code() const
+void Comment::write(ostream &stream, const unsigned int level) const
 {
-  const string decoration =
-    m_decorate ? string(COMMENT.rbegin(), COMMENT.rend()) : "";
+  write_comment(stream, m_text.data(), m_text.size(), m_decorate, level);
+}
 
-  return COMMENT + replace_all_copy(m_text, NL, decoration + NL + COMMENT)
-    + decoration;
+Token::Shape Command::shape() const
+{
+  return {CommandKind, &m_name, false, nullptr};
+}
+
+Token::Shape Block::shape() const
+{
+  const Kind kind = m_type == BraceStyle ? BraceBlockKind : BracketBlockKind;
+  return {kind, nullptr, false, nullptr};
+}
+
+Token::Shape Variable::shape() const
+{
+  return {VariableKind, &m_name, false, &m_value};
+}
+
+Token::Shape Boolean::shape() const
+{
+  return {BooleanKind, nullptr, m_value, nullptr};
+}
+
+Token::Shape String::shape() const
+{
+  return {StringKind, &m_value, false, nullptr};
+}
+
+Token::Shape Literal::shape() const
+{
+  return {LiteralKind, &m_value, false, nullptr};
+}
+
+Token::Shape Function::shape() const
+{
+  return {FunctionKind, &m_name, false, nullptr};
+}
+
+Token::Shape Comment::shape() const
+{
+  return {CommentKind, &m_text, m_decorate, nullptr};
 }
@@ -1,47 +1,149 @@
 #ifndef TOKENS_HPP
 #define TOKENS_HPP
 
+#include <functional>
 #include <memory>
 #include <ostream>
 #include <string>
+#include <utility>
 #include <vector>
 
+class FlatTree;
 class Token;
 
+// Tokens having at least `threshold` children render them on up to `jobs`
+// threads when enabled on a stream with set_parallel.
+struct ParallelWrite
+{
+  unsigned int jobs;
+  size_t threshold;
+};
+
+// The settings must outlive the writes. Passing null disables them.
+void set_parallel(std::ostream &, const ParallelWrite *);
+
 template <class T = Token>
 using TokenPtr = std::shared_ptr<T>;
 
 class Token
 {
+  friend class Arena;
+  friend class FlatTree;
   friend Token &operator<<(Token &, TokenPtr<>);
 
 public:
-  virtual ~Token(){}
-  virtual std::string code() const;
+  Token()
+    : m_parent(nullptr), m_shared(false), m_view(false), m_detached(false) {}
+  Token(const Token &) = delete;
+  virtual ~Token();
+
+  Token &operator=(const Token &) = delete;
+
+  std::string code() const;
+  virtual void write(std::ostream &, unsigned int level = 0) const;
   virtual bool empty() const { return false; }
 
+  // Marks a token appearing under many parents, which are not tracked. It
+  // must not be modified afterwards.
+  void set_shared() { m_shared = true; }
+
+  // Marks a token which is not tracked as the parent of its children, so it
+  // may outlive them as long as it is not written. Its own code is not
+  // cached, nor that of its parents.
+  void set_view() { m_view = true; }
+
+  // Removes every child.
+  void clear();
+
 protected:
+  enum Kind { SequenceKind, CommandKind, BraceBlockKind, BracketBlockKind,
+    VariableKind, BooleanKind, StringKind, LiteralKind, FunctionKind,
+    CommentKind, ForeignKind };
+
+  // How a FlatTree lays out the token. Tokens of other classes are written
+  // through their write() function.
+  struct Shape
+  {
+    Kind kind;
+    const std::string *text;
+    bool flag;
+    const TokenPtr<> *value;
+  };
+
+  virtual Shape shape() const;
+
+  // Drops the code cached by the token and its ancestors. Every mutator must
+  // call it.
+  void changed();
+  virtual void discard_code() {}
+
+  // Tracks this token as a parent of the child, so changes propagate.
+  void adopt(const TokenPtr<> &child);
+  void release(const TokenPtr<> &child);
+
+  // Whether a container skips the child when writing to the stream.
+  static bool omitted(const TokenPtr<> &child, bool compact);
+
+  static void newline(std::ostream &, unsigned int level);
+  static void write_text(std::ostream &, const std::string &,
+    unsigned int level);
+  static void write_text(std::ostream &, const char *, size_t,
+    unsigned int level);
+  static void write_string(std::ostream &, const char *, size_t,
+    unsigned int level);
+  static void write_comment(std::ostream &, const char *, size_t,
+    bool decorate, unsigned int level);
+
+  // Calls func for chunks of children on several threads and writes their
+  // output in order. Returns false when the stream or the number of children
+  // do not call for it.
+  bool write_parallel(std::ostream &,
+    const std::function<void(std::ostream &, size_t)> &func) const;
+
   const std::vector<TokenPtr<> > &children() const { return m_children; }
 
 private:
+  void add_parent(Token *);
+  void remove_parent(Token *);
+
   std::vector<TokenPtr<> > m_children;
+
+  // most tokens have a single parent
+  Token *m_parent;
+  std::unique_ptr<std::vector<Token *> > m_more_parents;
+
+  bool m_shared;
+  bool m_view;
+  bool m_detached;
 };
 
-std::ostream &operator<<(std::ostream &, const TokenPtr<>);
+// Blocks cache their code between writes. On streams rendering in parallel,
+// only the blocks written by the calling thread do.
+void set_memo(std::ostream &, bool enable);
+
+// Compact streams get the code with minimal whitespace: blocks are written
+// on a single line, top-level tokens on a line each and comments are left
+// out. The code of literals keeps its lines.
+void set_compact(std::ostream &, bool enable);
+bool is_compact(std::ostream &);
+
+std::ostream &operator<<(std::ostream &, const TokenPtr<> &);
 Token &operator<<(Token &, TokenPtr<>);
 
 class Command : public Token
 {
 public:
-  Command(const std::string &name) : m_name(name) {}
+  Command(std::string name) : m_name(std::move(name)) {}
 
-  virtual std::string code() const override;
+  virtual void write(std::ostream &, unsigned int level = 0) const override;
+  virtual Shape shape() const override;
   virtual bool empty() const override { return m_name.empty(); }
 
   const std::string &name() const { return m_name; }
-  void changeName(const std::string &val) { m_name = val; }
+  void changeName(std::string val) { m_name = std::move(val); changed(); }
 
-  Command &operator=(const std::string &val) { changeName(val); return *this; }
+  Command &operator=(std::string val)
+  { changeName(std::move(val)); return *this; }
 
 private:
   std::string m_name;
@@ -52,27 +154,40 @@ class Block : public Token
 public:
   enum BlockStyle { BraceStyle, BracketStyle };
 
-  Block(const BlockStyle type) : m_type(type) {}
-  virtual std::string code() const override;
+  Block(const BlockStyle type) : m_type(type), m_cached(false) {}
+  virtual void write(std::ostream &, unsigned int level = 0) const override;
+
+protected:
+  virtual Shape shape() const override;
+  virtual void discard_code() override;
 
 private:
+  void write_code(std::ostream &, unsigned int level) const;
+
   BlockStyle m_type;
+
+  mutable std::string m_code;
+  mutable unsigned int m_code_level;
+  mutable bool m_code_compact;
+  mutable bool m_cached;
 };
 
 class Variable : public Token
 {
 public:
-  Variable(const std::string &name, const TokenPtr<> value)
-    : m_name(name), m_value(value) {}
+  Variable(std::string name, TokenPtr<> value)
+    : m_name(std::move(name)), m_value(std::move(value)) { adopt(m_value); }
+  virtual ~Variable() { release(m_value); }
 
-  virtual std::string code() const override;
+  virtual void write(std::ostream &, unsigned int level = 0) const override;
+  virtual Shape shape() const override;
   virtual bool empty() const override { return m_value->empty(); }
 
   const TokenPtr<> &value() const { return m_value; }
-  void changeValue(const TokenPtr<> val) { m_value = val; }
+  void changeValue(TokenPtr<> val);
 
-  Variable &operator=(const TokenPtr<> &val)
-  { changeValue(val); return *this; }
+  Variable &operator=(TokenPtr<> val)
+  { changeValue(std::move(val)); return *this; }
 
 private:
   std::string m_name;
@@ -83,7 +198,8 @@ class Boolean : public Token
 {
 public:
   Boolean(const bool value) : m_value(value) {}
-  virtual std::string code() const override;
+  virtual void write(std::ostream &, unsigned int level = 0) const override;
+  virtual Shape shape() const override;
 
 private:
   bool m_value;
@@ -92,15 +208,16 @@ private:
 class String : public Token
 {
 public:
-  String(const std::string value = "") : m_value(value) {}
+  String(std::string value = std::string()) : m_value(std::move(value)) {}
 
-  virtual std::string code() const override;
+  virtual void write(std::ostream &, unsigned int level = 0) const override;
+  virtual Shape shape() const override;
   virtual bool empty() const override { return m_value.empty(); }
 
   const std::string &get() const { return m_value; }
-  void set(const std::string &val) { m_value = val; }
+  void set(std::string val) { m_value = std::move(val); changed(); }
 
-  String &operator=(const std::string &val) { set(val); return *this; }
+  String &operator=(std::string val) { set(std::move(val)); return *this; }
 
 private:
   std::string m_value;
@@ -109,23 +226,39 @@ private:
 class Literal : public Token
 {
 public:
-  Literal(const std::string value) : m_value(value) {}
-  virtual std::string code() const override;
+  Literal(std::string value) : m_value(std::move(value)) {}
+  virtual void write(std::ostream &, unsigned int level = 0) const override;
+  virtual Shape shape() const override;
 
   const std::string &get() const { return m_value; }
-  void set(const std::string &val) { m_value = val; }
+  void set(std::string val) { m_value = std::move(val); changed(); }
 
-  Literal &operator=(const std::string &val) { set(val); return *this; }
+  Literal &operator=(std::string val) { set(std::move(val)); return *this; }
 
 private:
   std::string m_value;
 };
 
+// Code rendered beforehand in both layouts, compact streams get the compact
+// one.
+class RenderedCode : public Token
+{
+public:
+  RenderedCode(std::string code, std::string compact_code)
+    : m_code(std::move(code)), m_compact_code(std::move(compact_code)) {}
+  virtual void write(std::ostream &, unsigned int level = 0) const override;
+
+private:
+  std::string m_code;
+  std::string m_compact_code;
+};
+
 class Function : public Token
 {
 public:
-  Function(const std::string name) : m_name(name) {}
-  virtual std::string code() const override;
+  Function(std::string name) : m_name(std::move(name)) {}
+  virtual void write(std::ostream &, unsigned int level = 0) const override;
+  virtual Shape shape() const override;
 
 private:
   std::string m_name;
@@ -134,10 +267,11 @@ private:
 class Comment : public Token
 {
 public:
-  Comment(const std::string text, const bool decorate = false)
-    : m_text(text), m_decorate(decorate) {}
+  Comment(std::string text, const bool decorate = false)
+    : m_text(std::move(text)), m_decorate(decorate) {}
 
-  virtual std::string code() const override;
+  virtual void write(std::ostream &, unsigned int level = 0) const override;
+  virtual Shape shape() const override;
 
 private:
   std::string m_text;
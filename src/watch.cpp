@@ -0,0 +1,116 @@
+#include "watch.hpp"
+
+#include <boost/format.hpp>
+#include <cerrno>
+#include <cstring>
+#include <unistd.h>
+
+#include "error.hpp"
+
+using namespace std;
+using format = boost::format;
+
+#ifdef __linux__
+
+#include <poll.h>
+#include <sys/inotify.h>
+
+const uint32_t WATCH_MASK = IN_CLOSE_WRITE | IN_MOVED_TO | IN_CREATE;
+
+Watcher::Watcher()
+  : m_fd(inotify_init1(IN_CLOEXEC | IN_NONBLOCK))
+{
+  if(m_fd < 0)
+    throw Error(format("cannot use inotify: %s") % strerror(errno));
+}
+
+Watcher::~Watcher()
+{
+  close(m_fd);
+}
+
+void Watcher::add(const string &file)
+{
+  const size_t slash = file.rfind('/');
+
+  const string dir = slash == string::npos ? "." : file.substr(0, slash + 1);
+  const string name = slash == string::npos ? file : file.substr(slash + 1);
+
+  const int wd = inotify_add_watch(m_fd, dir.c_str(), WATCH_MASK);
+
+  if(wd < 0) {
+    throw Error(format("cannot watch '%s': %s")
+      % file % strerror(errno));
+  }
+
+  // adding a directory twice returns the same descriptor
+  m_directories[wd].emplace(name, file);
+}
+
+void Watcher::read_events(set<string> *changed)
+{
+  alignas(inotify_event) char buffer[4096];
+  ssize_t size;
+
+  while((size = read(m_fd, buffer, sizeof(buffer))) > 0) {
+    for(char *ptr = buffer; ptr < buffer + size;) {
+      const inotify_event *event = (const inotify_event *)ptr;
+      ptr += sizeof(inotify_event) + event->len;
+
+      const auto dir = m_directories.find(event->wd);
+
+      if(dir == m_directories.end() || !event->len)
+        continue;
+
+      const auto file = dir->second.find(event->name);
+
+      if(file != dir->second.end())
+        changed->insert(file->second);
+    }
+  }
+
+  if(size < 0 && errno != EAGAIN && errno != EINTR)
+    throw Error(format("cannot read inotify events: %s") % strerror(errno));
+}
+
+vector<string> Watcher::wait(const int quiet)
+{
+  set<string> changed;
+  pollfd fd{m_fd, POLLIN, 0};
+
+  // wait for the first change, then for the burst of changes to end
+  while(changed.empty() || poll(&fd, 1, quiet) > 0) {
+    if(changed.empty() && poll(&fd, 1, -1) < 0 && errno != EINTR)
+      throw Error(format("cannot wait for changes: %s") % strerror(errno));
+
+    read_events(&changed);
+  }
+
+  return vector<string>(changed.begin(), changed.end());
+}
+
+#else
+
+Watcher::Watcher() : m_fd(-1)
+{
+  throw Error("watching files is only supported on Linux");
+}
+
+Watcher::~Watcher()
+{
+}
+
+void Watcher::add(const string &)
+{
+}
+
+void Watcher::read_events(set<string> *)
+{
+}
+
+vector<string> Watcher::wait(int)
+{
+  return vector<string>();
+}
+
+#endif
@@ -0,0 +1,38 @@
+#ifndef WATCH_HPP
+#define WATCH_HPP
+
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+
+// Notifies about changes to a set of files using inotify. The directories
+// are watched rather than the files, so that editors replacing a file on
+// save are handled too.
+//
+// Watching is only available on Linux. Elsewhere, the constructor throws.
+class Watcher
+{
+public:
+  Watcher();
+  ~Watcher();
+
+  Watcher(const Watcher &) = delete;
+  Watcher &operator=(const Watcher &) = delete;
+
+  void add(const std::string &file);
+
+  // Blocks until a watched file changes, then until no more changes happen
+  // for `quiet` milliseconds. Returns the files that changed meanwhile.
+  std::vector<std::string> wait(int quiet);
+
+private:
+  void read_events(std::set<std::string> *changed);
+
+  typedef std::map<std::string, std::string> Files; // base name -> file
+
+  int m_fd;
+  std::map<int, Files> m_directories;
+};
+
+#endif
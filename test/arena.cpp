@@ -0,0 +1,88 @@
+#include "vendor/catch.hpp"
+
+#include <cstdint>
+#include <vector>
+
+#include "../src/arena.hpp"
+
+using namespace std;
+
+static const char *M = "[arena]";
+
+template <size_t Align>
+class AlignedToken : public Token
+{
+public:
+  void write(std::ostream &, unsigned int) const {}
+
+  alignas(Align) char m_data[3];
+};
+
+class TracedToken : public Token
+{
+public:
+  TracedToken(vector<int> *log, const int id) : m_log(log), m_id(id) {}
+  ~TracedToken() { m_log->push_back(m_id); }
+
+  void write(std::ostream &, unsigned int) const {}
+
+private:
+  vector<int> *m_log;
+  int m_id;
+};
+
+TEST_CASE("Arena", M) {
+  SECTION("Alignment") {
+    Arena arena(256);
+
+    for(int i = 0; i < 20; i++) {
+      const auto boolean = arena.make<Boolean>(true);
+      const auto aligned = arena.make<AlignedToken<64> >();
+      const auto string = arena.make<String>("x");
+      const auto small = arena.make<AlignedToken<16> >();
+
+      REQUIRE(((uintptr_t)boolean.get() % alignof(Boolean)) == 0);
+      REQUIRE(((uintptr_t)aligned.get() % 64) == 0);
+      REQUIRE(((uintptr_t)string.get() % alignof(String)) == 0);
+      REQUIRE(((uintptr_t)small.get() % 16) == 0);
+    }
+
+    REQUIRE(arena.size() == 80);
+  }
+
+  SECTION("Destroyed in reverse order") {
+    vector<int> log;
+
+    {
+      Arena arena;
+      auto parent = arena.make<TracedToken>(&log, 1);
+      *parent << arena.make<TracedToken>(&log, 2);
+      arena.make<TracedToken>(&log, 3);
+      REQUIRE(log.empty());
+    }
+
+    REQUIRE(log == (vector<int>{3, 2, 1}));
+  }
+
+  SECTION("Tokens outliving their arena parent") {
+    auto value = make_shared<String>("a");
+    auto child = make_shared<String>("b");
+
+    {
+      Arena arena;
+      auto variable = arena.make<Variable>("foo", value);
+      auto block = arena.make<Block>(Block::BraceStyle);
+      *block << child;
+      REQUIRE(block->code() == "{\n  \"b\"\n}");
+
+      // detached from the variable before the arena goes away
+      variable->changeValue(arena.make<String>("c"));
+    }
+
+    // changes must not reach the parents that are gone
+    *value = "x";
+    *child = "y";
+    REQUIRE(value->code() == "\"x\"");
+    REQUIRE(child->code() == "\"y\"");
+  }
+}
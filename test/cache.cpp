@@ -0,0 +1,164 @@
+#include "vendor/catch.hpp"
+
+#include <cstdlib>
+#include <boost/format.hpp>
+#include <dirent.h>
+#include <fstream>
+#include <sstream>
+#include <unistd.h>
+
+#include "../src/cache.hpp"
+#include "../src/generators.hpp"
+#include "../src/reader.hpp"
+
+using namespace std;
+
+static const char *M = "[cache]";
+
+static string generate(const string &input, const FragmentCache *cache,
+  const bool compact = false, vector<string> *sources = nullptr)
+{
+  Document doc;
+  istringstream stream(input);
+  YamlReader(doc, cache).read(stream);
+
+  if(sources) {
+    for(size_t i = 0; i < doc.units().size(); i++)
+      sources->push_back(doc.unit_token(i)->code());
+  }
+
+  ostringstream output;
+  set_compact(output, compact);
+  output << doc.token();
+  return output.str();
+}
+
+static size_t count_entries(const string &path)
+{
+  size_t count = 0;
+
+  DIR *dir = opendir(path.c_str());
+  while(const dirent *entry = readdir(dir))
+    count += entry->d_name[0] != '.';
+  closedir(dir);
+
+  return count;
+}
+
+TEST_CASE("Fragment cache", M) {
+  char path[] = "/tmp/partman-cache-XXXXXX";
+  REQUIRE(mkdtemp(path));
+
+  const FragmentCache cache(path);
+
+  const string input =
+    "parts:\n"
+    "  violin: {name: Violin, relative: c''}\n"
+    "  piano: {parts: {right: {}, left: {}}}\n"
+    "score: {parts: [violin, [piano]], midi: {}}\n"
+    "book:\n"
+    "  - {parts: [violin]}\n"
+  ;
+
+  const string expected = generate(input, nullptr);
+
+  SECTION("Same output as without cache") {
+    REQUIRE(generate(input, &cache) == expected);
+    REQUIRE(count_entries(path) == 4);
+    REQUIRE(generate(input, &cache) == expected);
+    REQUIRE(count_entries(path) == 4);
+  }
+
+  SECTION("Only changed fragments are generated again") {
+    generate(input, &cache);
+
+    string changed = input;
+    changed.replace(changed.find("c''"), 3, "d'");
+
+    REQUIRE(generate(changed, &cache) == generate(changed, nullptr));
+    REQUIRE(count_entries(path) == 5);
+  }
+
+  SECTION("Identifiers are still unique") {
+    generate("parts: {piano: {}}\n", &cache);
+
+    // the cached piano part must not take a conflicting identifier
+    const string other = "parts: {a: ~, piano: {}}\nscore: {parts: [piano]}\n";
+    REQUIRE(generate(other, &cache) == generate(other, nullptr));
+  }
+
+  SECTION("Compact caches") {
+    const FragmentCache compact(path, true);
+    const string expected_compact = generate(input, nullptr, true);
+
+    vector<string> sources, expected_sources;
+    generate(input, nullptr, false, &expected_sources);
+
+    // twice, generating then loading the fragments
+    for(int i = 0; i < 2; i++) {
+      sources.clear();
+      REQUIRE(generate(input, &compact, true, &sources) == expected_compact);
+      REQUIRE(sources == expected_sources);
+      REQUIRE(generate(input, &compact) == expected);
+    }
+
+    REQUIRE(count_entries(path) == 4);
+  }
+
+  system((string("rm -rf ") + path).c_str());
+}
+
+TEST_CASE("Broken cache entries", M) {
+  char path[] = "/tmp/partman-cache-XXXXXX";
+  REQUIRE(mkdtemp(path));
+
+  const FragmentCache cache(path);
+  const uint64_t key = 0x1234;
+
+  FragmentCache::Fragment fragment{{{"violin", "pm_violin"}}, "code", ""};
+  FragmentCache(path).store(key, fragment);
+
+  const string entry = (boost::format("%s/%016x") % path % key).str();
+
+  auto write_entry = [&](const string &contents) {
+    ofstream(entry, ios::binary | ios::trunc) << contents;
+  };
+
+  FragmentCache::Fragment loaded{{{"old", "pm_old"}}, "old", ""};
+
+  SECTION("Valid") {
+    REQUIRE(cache.load(key, &loaded));
+    REQUIRE(loaded.code == "code");
+    REQUIRE(loaded.identifiers == fragment.identifiers);
+  }
+
+  SECTION("Truncated") {
+    ifstream stream(entry, ios::binary);
+    const string contents((istreambuf_iterator<char>(stream)),
+      istreambuf_iterator<char>());
+
+    write_entry(contents.substr(0, contents.size() - 2));
+    REQUIRE_FALSE(cache.load(key, &loaded));
+  }
+
+  SECTION("Huge string size") {
+    write_entry("partman-fragment 2\n1\n18446744073709551615\nx");
+    REQUIRE_FALSE(cache.load(key, &loaded));
+  }
+
+  SECTION("Huge identifier count") {
+    write_entry("partman-fragment 2\n1000000000000\n0\n0\n");
+    REQUIRE_FALSE(cache.load(key, &loaded));
+  }
+
+  SECTION("Not a number") {
+    write_entry("partman-fragment 2\n-1\n");
+    REQUIRE_FALSE(cache.load(key, &loaded));
+  }
+
+  // a miss leaves the fragment alone
+  if(loaded.code != "code")
+    REQUIRE(loaded.code == "old");
+
+  system((string("rm -rf ") + path).c_str());
+}
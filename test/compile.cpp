@@ -0,0 +1,201 @@
+#include "vendor/catch.hpp"
+
+#include <cstdlib>
+#include <fstream>
+#include <sstream>
+#include <unistd.h>
+
+#include "../src/compile.hpp"
+#include "../src/generators.hpp"
+#include "../src/reader.hpp"
+#include "../src/store.hpp"
+
+using namespace std;
+
+static const char *M = "[compile]";
+
+TEST_CASE("Scores and books are units", M) {
+  Document doc;
+  istringstream stream(
+    "parts: {violin: {}}\n"
+    "score: {parts: [violin]}\n"
+    "book: [{parts: [violin]}, {parts: [violin]}]\n"
+    "parts: {viola: {}}\n"
+  );
+  YamlReader(doc).read(stream);
+
+  REQUIRE(doc.units().size() == 2);
+  REQUIRE(doc.units()[0].type == Document::ScoreUnit);
+  REQUIRE(doc.units()[1].type == Document::BookUnit);
+
+  const string score = doc.unit_token(0)->code();
+
+  // all the definitions, but not the other units
+  REQUIRE(score.find("\\new Staff = \"violin\"") != string::npos);
+  REQUIRE(score.find("\\new Staff = \"viola\"") != string::npos);
+  REQUIRE(score.find("\\score") != string::npos);
+  REQUIRE(score.find("\\book") == string::npos);
+}
+
+TEST_CASE("Shards include the definitions", M) {
+  Document doc;
+  istringstream stream(
+    "parts: {violin: {}}\n"
+    "score: {parts: [violin]}\n"
+  );
+  YamlReader(doc).read(stream);
+
+  const string definitions = doc.definitions_token()->code();
+  REQUIRE(definitions.find("\\new Staff") != string::npos);
+  REQUIRE(definitions.find("\\score") == string::npos);
+
+  const string shard = doc.shard_token(0, "defs.ly")->code();
+  REQUIRE(shard.find("\\version") != string::npos);
+  REQUIRE(shard.find("\\include \"defs.ly\"") != string::npos);
+  REQUIRE(shard.find("\\new Staff") == string::npos);
+  REQUIRE(shard.find("\\score") != string::npos);
+}
+
+TEST_CASE("Shards regenerated in place", M) {
+  // as the results of --watch --split: the document is replaced before the
+  // shards built from it
+  struct Result
+  {
+    shared_ptr<Document> doc;
+    vector<TokenPtr<> > shards;
+  };
+
+  auto generate = [](const string &input) {
+    Result result{make_shared<Document>(true), {}};
+    istringstream stream(input);
+    YamlReader(*result.doc).read(stream);
+
+    result.shards.push_back(result.doc->definitions_token());
+    result.shards.push_back(result.doc->shard_token(0, "defs.ly"));
+    result.shards.push_back(result.doc->unit_token(0));
+    return result;
+  };
+
+  const string input =
+    "parts: {violin: {}}\n"
+    "score: {parts: [violin]}\n";
+
+  Result result = generate(input);
+  const string code = result.shards[1]->code();
+
+  result = generate(input + "parts: {viola: {}}\n");
+  REQUIRE(result.shards[1]->code() == code);
+  REQUIRE(result.shards[0]->code().find("viola") != string::npos);
+}
+
+TEST_CASE("Running the compiler", M) {
+  char path[] = "/tmp/partman-compile-XXXXXX";
+  REQUIRE(mkdtemp(path));
+
+  const vector<CompileJob> jobs{{"a", "short"}, {"b", "longer source"}};
+
+  SECTION("Exit status") {
+    REQUIRE(Compiler("true", path).run(jobs, 2)[1].status == 0);
+    REQUIRE(Compiler("false", path).run(jobs, 2)[0].status == 1);
+    REQUIRE(Compiler("/nonexistent", path).run(jobs, 2)[0].status == -1);
+  }
+
+  SECTION("Sources that cannot be written") {
+    REQUIRE(system(("mkdir " + string(path) + "/a.ly").c_str()) == 0);
+
+    const vector<CompileResult> results = Compiler("true", path).run(jobs, 2);
+    REQUIRE(results[0].status == -1);
+    REQUIRE(results[0].error.find("a.ly") != string::npos);
+    REQUIRE(results[1].status == 0);
+    REQUIRE(results[1].error.empty());
+  }
+
+  SECTION("Sources are written") {
+    const Compiler compiler("true", path);
+    compiler.run(jobs, 1);
+
+    ifstream source(compiler.source_path(jobs[1]));
+    REQUIRE(string(istreambuf_iterator<char>(source), {}) == jobs[1].source);
+  }
+
+  system((string("rm -rf ") + path).c_str());
+}
+
+TEST_CASE("Restoring compiled outputs", M) {
+  char path[] = "/tmp/partman-store-XXXXXX";
+  REQUIRE(mkdtemp(path));
+
+  const string out = string(path) + "/out";
+  const ResultStore store(string(path) + "/store", 1 << 20);
+  const Compiler compiler("echo", out, &store);
+
+  vector<CompileJob> jobs{{"a", "\\include \"" + string(path) + "/a.ily\""}};
+
+  REQUIRE_FALSE(compiler.run(jobs, 1)[0].restored);
+  REQUIRE(compiler.run(jobs, 1)[0].restored);
+
+  SECTION("Changed source") {
+    jobs[0].source += " ";
+    REQUIRE_FALSE(compiler.run(jobs, 1)[0].restored);
+  }
+
+  SECTION("Changed include") {
+    ofstream(string(path) + "/a.ily") << "{ c }";
+    REQUIRE_FALSE(compiler.run(jobs, 1)[0].restored);
+  }
+
+  SECTION("Eviction") {
+    ResultStore(string(path) + "/store", 0).evict();
+    REQUIRE_FALSE(compiler.run(jobs, 1)[0].restored);
+  }
+
+  system((string("rm -rf ") + path).c_str());
+}
+
+TEST_CASE("Finding included files", M) {
+  char path[] = "/tmp/partman-include-XXXXXX";
+  REQUIRE(mkdtemp(path));
+
+  const string dir = path;
+  const string out = dir + "/out";
+  const string lib = dir + "/lib";
+  system(("mkdir -p " + out + "/parts " + lib).c_str());
+
+  const ResultStore store(dir + "/store", 1 << 20);
+  const vector<CompileJob> jobs{{"a", "\\include \"parts/a.ily\""}};
+
+  SECTION("Next to the source") {
+    const Compiler compiler("echo", out, &store);
+    ofstream(out + "/parts/a.ily") << "\\include \"b.ily\"";
+    ofstream(out + "/parts/b.ily") << "{ c }";
+
+    REQUIRE_FALSE(compiler.run(jobs, 1)[0].restored);
+    REQUIRE(compiler.run(jobs, 1)[0].restored);
+
+    // included by the included file
+    ofstream(out + "/parts/b.ily") << "{ d }";
+    REQUIRE_FALSE(compiler.run(jobs, 1)[0].restored);
+  }
+
+  SECTION("In the include paths") {
+    system(("mkdir -p " + lib + "/parts").c_str());
+    ofstream(lib + "/parts/a.ily") << "{ c }";
+
+    const Compiler compiler("echo", out, &store, {lib});
+    REQUIRE_FALSE(compiler.run(jobs, 1)[0].restored);
+    REQUIRE(compiler.run(jobs, 1)[0].restored);
+
+    ofstream(lib + "/parts/a.ily") << "{ d }";
+    REQUIRE_FALSE(compiler.run(jobs, 1)[0].restored);
+
+    ifstream log(compiler.log_path(jobs[0]));
+    string line;
+    getline(log, line);
+    REQUIRE(line == "-I " + lib + " -o " + out + "/a " + out + "/a.ly");
+
+    // the paths are part of the key
+    REQUIRE_FALSE(Compiler("echo", out, &store).run(jobs, 1)[0].restored);
+  }
+
+  system((string("rm -rf ") + path).c_str());
+}
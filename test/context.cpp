@@ -0,0 +1,45 @@
+#include "vendor/catch.hpp"
+
+#include "../src/context.hpp"
+
+using namespace std;
+
+static const char *M = "[context]";
+
+TEST_CASE("Interned tokens", M) {
+  Context context;
+
+  SECTION("Same arguments, same instance") {
+    const auto a = context.intern<String>("Staff_performer");
+    REQUIRE(context.intern<String>(string("Staff_performer")) == a);
+    REQUIRE(context.intern<String>("Staff_engraver") != a);
+    REQUIRE(context.interned() == 2);
+  }
+
+  SECTION("The type is part of the key") {
+    TokenPtr<> string = context.intern<String>("x");
+    TokenPtr<> literal = context.intern<Literal>("x");
+    REQUIRE(string != literal);
+  }
+
+  SECTION("Arguments are delimited") {
+    REQUIRE(context.intern<Comment>("ab", false)
+      != context.intern<Comment>("a", true));
+  }
+
+  SECTION("Subtrees") {
+    const auto value = context.intern<String>("Staff_performer");
+    const auto remove = context.intern_node<Command>({value}, "remove");
+
+    REQUIRE(remove->code() == "\\remove \"Staff_performer\"");
+    REQUIRE(context.intern_node<Command>({value}, "remove") == remove);
+    REQUIRE(context.intern<Command>("remove") != remove);
+  }
+
+  SECTION("Arena") {
+    Context arena(true);
+    const auto a = arena.intern<Literal>("c''");
+    REQUIRE(arena.intern<Literal>("c''") == a);
+    REQUIRE(arena.arena()->size() == 1);
+  }
+}
@@ -0,0 +1,130 @@
+#include "vendor/catch.hpp"
+
+#include <sstream>
+
+#include "../src/error.hpp"
+#include "../src/generators.hpp"
+#include "../src/parallel.hpp"
+#include "../src/reader.hpp"
+
+using namespace std;
+
+static const char *M = "[document]";
+
+static const char *INPUT =
+  "parts: {violin: {}, viola: {}, cello: {}}\n"
+  "score: {parts: [violin, viola], layout: {}}\n"
+  "book: [{parts: [cello]}, {parts: [[violin, cello]]}]\n"
+;
+
+static void read(Document &doc, const string &input)
+{
+  istringstream stream(input);
+  YamlReader(doc).read(stream);
+}
+
+static bool contains(const string &code, const string &text)
+{
+  return code.find(text) != string::npos;
+}
+
+TEST_CASE("Part references", M) {
+  Document doc;
+  read(doc, INPUT);
+
+  REQUIRE(doc.part_refs(doc.units()[0]) ==
+    (vector<string>{"violin", "viola"}));
+  REQUIRE(doc.part_refs(doc.units()[1]) ==
+    (vector<string>{"cello", "violin"}));
+}
+
+TEST_CASE("Previewing a unit", M) {
+  Document doc;
+  read(doc, INPUT);
+
+  doc.preview_unit(0);
+
+  const string code = doc.token()->code();
+  REQUIRE(doc.units().size() == 1);
+  REQUIRE(contains(code, "Staff = \"viola\""));
+  REQUIRE_FALSE(contains(code, "Staff = \"cello\""));
+  REQUIRE_FALSE(contains(code, "\\book"));
+  REQUIRE_FALSE(contains(code, "\\layout"));
+  REQUIRE(contains(code, "\\midi"));
+}
+
+TEST_CASE("Previewing parts", M) {
+  Document doc;
+  read(doc, INPUT);
+
+  doc.preview_parts({"cello"});
+
+  const string code = doc.token()->code();
+  REQUIRE(doc.units().size() == 1);
+  REQUIRE(doc.part_refs(doc.units()[0]) == vector<string>{"cello"});
+  REQUIRE_FALSE(contains(code, "Staff = \"violin\""));
+  REQUIRE(contains(code, "\\midi"));
+
+  REQUIRE_THROWS_AS(doc.preview_parts({"piano"}), const Error &);
+}
+
+TEST_CASE("Pruning unreferenced parts", M) {
+  Document doc;
+  read(doc, string(INPUT) + "parts: {piano: {parts: {upper: {}}}}\n");
+
+  REQUIRE(doc.prune() == vector<string>{"piano"});
+
+  const string code = doc.token()->code();
+  REQUIRE(contains(code, "Staff = \"cello\""));
+  REQUIRE_FALSE(contains(code, "piano"));
+  REQUIRE(doc.prune().empty());
+}
+
+TEST_CASE("Documents generated in parallel", M) {
+  // the same part names in both files, each with its own context
+  const vector<string> inputs{
+    "parts: {violin: {}, viola: {}, violin_1: {}}\n"
+    "score: {parts: [violin, viola, violin_1]}\n",
+    "parts: {violin: {relative: c''}, cello: {}, violin1: {}}\n"
+    "score: {parts: [cello, violin, violin1]}\n",
+  };
+
+  auto generate = [&](const string &input, size_t *identifiers) {
+    Document doc(true);
+    read(doc, input);
+    *identifiers = doc.identifiers().size();
+
+    ostringstream output;
+    output << doc.token();
+    return output.str();
+  };
+
+  vector<string> serial(inputs.size());
+  vector<size_t> serial_ids(inputs.size());
+
+  for(size_t i = 0; i < inputs.size(); i++)
+    serial[i] = generate(inputs[i], &serial_ids[i]);
+
+  for(int run = 0; run < 10; run++) {
+    vector<string> outputs(inputs.size());
+    vector<size_t> ids(inputs.size());
+
+    parallel_for(inputs.size() * 4, 4, [&](const size_t i) {
+      const size_t file = i % inputs.size();
+      size_t count;
+      const string output = generate(inputs[file], &count);
+
+      if(i < inputs.size()) {
+        outputs[file] = output;
+        ids[file] = count;
+      }
+    });
+
+    REQUIRE(outputs == serial);
+    REQUIRE(ids == serial_ids);
+  }
+
+  // no identifier of the other file
+  REQUIRE(!contains(serial[0], "cello"));
+  REQUIRE(!contains(serial[1], "viola"));
+}
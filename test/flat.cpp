@@ -0,0 +1,83 @@
+#include "vendor/catch.hpp"
+
+#include <sstream>
+
+#include "../src/flat.hpp"
+#include "../src/generators.hpp"
+#include "../src/reader.hpp"
+#include "tokens_mock.hpp"
+
+using namespace std;
+
+static const char *M = "[flat]";
+
+TEST_CASE("Flat tree", M) {
+  TokenPtr<> root = make_shared<Token>();
+
+  SECTION("Empty") {
+    REQUIRE(FlatTree(root).code() == "");
+    REQUIRE(FlatTree(root).size() == 1);
+  }
+
+  SECTION("Every kind of token") {
+    auto block = make_shared<Block>(Block::BraceStyle);
+    auto command = make_shared<Command>("new");
+    *command << make_shared<Literal>("Staff");
+    *command << make_shared<EmptyToken>();
+    *command << block;
+
+    auto function = make_shared<Function>("set-paper-size");
+    *function << make_shared<String>("a4\n\"x\"");
+    *function << make_shared<Boolean>(true);
+
+    auto staves = make_shared<Block>(Block::BracketStyle);
+    *staves << make_shared<Literal>("a\nb");
+    *staves << make_shared<Block>(Block::BraceStyle);
+
+    *block << make_shared<Variable>("foo", function);
+    *block << make_shared<EmptyToken>();
+    *block << staves;
+    *block << make_shared<Boolean>(false);
+
+    *root << make_shared<Comment>("hello\nworld", true);
+    *root << make_shared<Comment>("x");
+    *root << command;
+    *root << make_shared<Command>("");
+    *root << make_shared<TestToken>();
+
+    REQUIRE(FlatTree(root).code() == root->code());
+
+    ostringstream compact, expected;
+    set_compact(compact, true);
+    set_compact(expected, true);
+    compact << FlatTree(root);
+    expected << root;
+    REQUIRE(compact.str() == expected.str());
+
+    ostringstream stream;
+    FlatTree(block).write(stream, 2);
+    REQUIRE(stream.str() == [&] {
+      ostringstream expected;
+      block->write(expected, 2);
+      return expected.str();
+    }());
+  }
+
+  SECTION("Document") {
+    Document doc;
+    istringstream input(
+      "header: {title: Title}\n"
+      "parts:\n"
+      "  violin: {name: [Violin, Vln.], relative: c'', instrument: violin}\n"
+      "  piano: {type: PianoStaff, parts: {upper: {}, lower: {}}}\n"
+      "score: {parts: [violin, [piano]], midi: {}}\n"
+      "book:\n"
+      "  - parts: [violin]\n"
+    );
+    YamlReader(doc).read(input);
+
+    ostringstream stream;
+    stream << FlatTree(doc.token());
+    REQUIRE(stream.str() == doc.token()->code());
+  }
+}
@@ -0,0 +1,78 @@
+#include "vendor/catch.hpp"
+
+#include "../src/identifiers.hpp"
+
+using namespace std;
+
+static const char *M = "[identifiers]";
+
+TEST_CASE("Identifiers", M) {
+  IdentifierMap ids;
+
+  SECTION("Format") {
+    const string id = ids.get("violin_1");
+    REQUIRE(id.size() == string("pm_xxxxxxxx_violin1").size());
+    REQUIRE(id.substr(0, 3) == "pm_");
+    REQUIRE(id.substr(11) == "_violin1");
+  }
+
+  SECTION("Same name, same identifier") {
+    const string id = ids.get("violin");
+    REQUIRE(ids.get("violin") == id);
+    REQUIRE(ids.size() == 1);
+  }
+
+  SECTION("Stable across instances") {
+    IdentifierMap other;
+    other.get("piano");
+    REQUIRE(other.get("violin") == ids.get("violin"));
+  }
+
+  SECTION("Names differing only by punctuation") {
+    REQUIRE(ids.get("a-b") != ids.get("ab"));
+  }
+}
+
+TEST_CASE("Restoring identifiers", M) {
+  IdentifierMap ids;
+  IdentifierMap::Entries log;
+
+  ids.set_log(&log);
+  ids.get("violin");
+  ids.get("piano");
+  ids.set_log(nullptr);
+
+  REQUIRE(log.size() == 2);
+
+  SECTION("Into an empty map") {
+    IdentifierMap other;
+    REQUIRE(other.restore(log));
+    REQUIRE(other.size() == 2);
+    REQUIRE(other.get("piano") == ids.get("piano"));
+  }
+
+  SECTION("Conflicting identifier") {
+    IdentifierMap other;
+    IdentifierMap::Entries wrong{{"viola", ids.get("violin")}, log[1]};
+    REQUIRE_FALSE(other.restore(wrong));
+    REQUIRE(other.size() == 0);
+  }
+
+  SECTION("Already registered") {
+    REQUIRE(ids.restore(log));
+    REQUIRE(ids.size() == 2);
+  }
+}
+
+TEST_CASE("Overlay on a base map", M) {
+  IdentifierMap base;
+  const string violin = base.get("violin");
+
+  IdentifierMap overlay(&base);
+  REQUIRE(overlay.get("violin") == violin);
+  REQUIRE(overlay.size() == 0);
+
+  const string piano = overlay.get("piano");
+  REQUIRE(piano == IdentifierMap().get("piano"));
+  REQUIRE(base.size() == 1);
+}
@@ -0,0 +1,131 @@
+#include "vendor/catch.hpp"
+
+#include <cstdlib>
+#include <fcntl.h>
+#include <ostream>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+#include "../src/output.hpp"
+
+using namespace std;
+
+static const char *M = "[output]";
+
+static string contents(const string &path)
+{
+  string content;
+  REQUIRE(read_file(path, &content));
+  return content;
+}
+
+static bool sink_write(const string &path, const string &content)
+{
+  FileSink sink(path);
+  ostream stream(&sink);
+
+  // small writes going through the buffers
+  for(size_t i = 0; i < content.size(); i += 1000)
+    stream << content.substr(i, 1000);
+
+  return sink.commit();
+}
+
+TEST_CASE("File sink", M) {
+  char dir[] = "/tmp/partman-output-XXXXXX";
+  REQUIRE(mkdtemp(dir));
+
+  const string path = string(dir) + "/out.ly";
+
+  // spans several flushes of the buffers
+  string content;
+  for(int i = 0; content.size() < 1000 * 1000; i++)
+    content += "line " + to_string(i) + "\n";
+
+  REQUIRE(sink_write(path, content));
+  REQUIRE(contents(path) == content);
+
+  // an old modification time shows whether the file was replaced
+  const timeval old[2] = {{1000, 0}, {1000, 0}};
+  REQUIRE(utimes(path.c_str(), old) == 0);
+
+  const auto mtime = [&] {
+    struct stat info;
+    REQUIRE(stat(path.c_str(), &info) == 0);
+    return info.st_mtime;
+  };
+
+  SECTION("Identical content") {
+    REQUIRE_FALSE(sink_write(path, content));
+    REQUIRE_FALSE(write_if_changed(path, content));
+    REQUIRE(mtime() == 1000);
+  }
+
+  SECTION("Different at the end") {
+    string changed = content;
+    changed.back() = '!';
+
+    REQUIRE(sink_write(path, changed));
+    REQUIRE(contents(path) == changed);
+    REQUIRE(mtime() != 1000);
+  }
+
+  SECTION("Different in the middle") {
+    string changed = content;
+    changed[content.size() / 2] = '!';
+
+    REQUIRE(write_if_changed(path, changed));
+    REQUIRE(contents(path) == changed);
+  }
+
+  SECTION("Keeps the permissions") {
+    REQUIRE(chmod(path.c_str(), 0640) == 0);
+    REQUIRE(sink_write(path, content + "x"));
+
+    struct stat info;
+    REQUIRE(stat(path.c_str(), &info) == 0);
+    REQUIRE((info.st_mode & 07777) == 0640);
+  }
+
+  SECTION("Longer or shorter") {
+    REQUIRE(sink_write(path, content + "x"));
+    REQUIRE(contents(path) == content + "x");
+
+    REQUIRE(sink_write(path, content.substr(0, 1234)));
+    REQUIRE(contents(path) == content.substr(0, 1234));
+  }
+
+  SECTION("Empty") {
+    REQUIRE(sink_write(path, ""));
+    REQUIRE(contents(path) == "");
+    REQUIRE_FALSE(sink_write(path, ""));
+  }
+
+  SECTION("Not committed") {
+    {
+      FileSink sink(path);
+      ostream(&sink) << "partial";
+    }
+
+    REQUIRE(contents(path) == content);
+    REQUIRE(list_directory(dir).size() == 1);
+  }
+
+  SECTION("Descriptor") {
+    const string other = string(dir) + "/fd.ly";
+    const int fd = open(other.c_str(), O_WRONLY | O_CREAT, 0666);
+    REQUIRE(fd >= 0);
+
+    {
+      FileSink sink(fd);
+      ostream(&sink) << content;
+      REQUIRE(sink.commit());
+    }
+
+    close(fd);
+    REQUIRE(contents(other) == content);
+  }
+
+  system((string("rm -rf ") + dir).c_str());
+}
@@ -0,0 +1,113 @@
+#include "vendor/catch.hpp"
+
+#include <sstream>
+#include <yaml-cpp/yaml.h>
+
+#include "../src/error.hpp"
+#include "../src/generators.hpp"
+#include "../src/parser.hpp"
+
+using namespace std;
+
+static const char *M = "[parser]";
+
+static string from_yaml(const string &input)
+{
+  Document doc;
+  for(const YAML::Node &root : YAML::LoadAll(input))
+    doc.read_yaml(root);
+
+  ostringstream stream;
+  stream << doc.token();
+  return stream.str();
+}
+
+static string from_partman(const string &input)
+{
+  Document doc;
+  Parser(doc).parse(input.data(), input.size());
+
+  ostringstream stream;
+  stream << doc.token();
+  return stream.str();
+}
+
+static string parse_error(const string &input)
+{
+  try {
+    from_partman(input);
+  }
+  catch(const Error &err) {
+    return err.what();
+  }
+
+  return "";
+}
+
+TEST_CASE("Same output as the YAML input", M) {
+  SECTION("Key-value blocks") {
+    REQUIRE(from_partman(
+      "version = 2.19.0 % comment\n"
+      "\\header { title = \"Lorem \\\"Ipsum\\\"\"\n tagline = true }\n"
+      "\\paper {\n  paper-size = a4\n  top-margin = 0.7\\cm\n}\n"
+      "\\setup { key = c \\major\n time = 4/4 }\n"
+    ) == from_yaml(
+      "version: 2.19.0\n"
+      "header: {title: 'Lorem \"Ipsum\"', tagline: true}\n"
+      "paper: {paper-size: a4, top-margin: 0.7\\cm}\n"
+      "setup: {key: c \\major, time: 4/4}\n"
+    ));
+  }
+
+  SECTION("Parts and scores") {
+    REQUIRE(from_partman(
+      "\\parts {\n"
+      "  violin { name = \"Violin\" \"Vln.\" relative = c'' }\n"
+      "  piano {\n"
+      "    name = Piano\n"
+      "    type = PianoStaff\n"
+      "    prefix = false\n"
+      "    \\parts { upper { instrument = \"acoustic grand\" } }\n"
+      "  }\n"
+      "}\n"
+      "\\score { violin << piano >> \\midi {} }\n"
+      "\\book { \\score { violin } \\score { piano \\header { piece = I } } }\n"
+    ) == from_yaml(
+      "parts:\n"
+      "  violin: {name: [Violin, Vln.], relative: c''}\n"
+      "  piano:\n"
+      "    name: Piano\n"
+      "    type: PianoStaff\n"
+      "    prefix: false\n"
+      "    parts: {upper: {instrument: acoustic grand}}\n"
+      "score: {parts: [violin, [piano]], midi: }\n"
+      "---\n"
+      "book:\n"
+      "  - parts: [violin]\n"
+      "  - {parts: [piano], header: {piece: I}}\n"
+    ));
+  }
+}
+
+TEST_CASE("Braces in unquoted values", M) {
+  const string code = from_partman("\\header { title = \\markup { A } }");
+  REQUIRE(code.find("title = \\markup { A }\n}") != string::npos);
+}
+
+TEST_CASE("Parse errors report the line and column", M) {
+  SECTION("Invalid key") {
+    REQUIRE(parse_error("\n  foo = 1") == "2:3: invalid key 'foo'");
+  }
+
+  SECTION("Unterminated block") {
+    REQUIRE(parse_error("\\setup {\n  time = 4/4\n") == "3:1: missing '}'");
+  }
+
+  SECTION("Missing value") {
+    REQUIRE(parse_error("\\header { title = }") == "1:19: expected a value");
+  }
+
+  SECTION("Unbalanced staff group") {
+    REQUIRE(parse_error("\\score { a >> }") == "1:12: unexpected '>>'");
+  }
+}
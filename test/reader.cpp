@@ -0,0 +1,136 @@
+#include "vendor/catch.hpp"
+
+#include <sstream>
+#include <yaml-cpp/yaml.h>
+
+#include "../src/error.hpp"
+#include "../src/generators.hpp"
+#include "../src/reader.hpp"
+
+using namespace std;
+
+static const char *M = "[reader]";
+
+static string from_nodes(const string &input)
+{
+  Document doc;
+  for(const YAML::Node &root : YAML::LoadAll(input))
+    doc.read_yaml(root);
+
+  ostringstream stream;
+  stream << doc.token();
+  return stream.str();
+}
+
+static string from_events(const string &input)
+{
+  Document doc;
+  istringstream stream(input);
+  YamlReader(doc).read(stream);
+
+  ostringstream output;
+  output << doc.token();
+  return output.str();
+}
+
+TEST_CASE("Same output as Document::read_yaml", M) {
+  const char *inputs[] = {
+    "",
+    "header: {title: My Score, tagline: true, subtitle: ~}\n"
+    "paper: {paper-size: a4, top-margin: 0.7\\cm, ragged-last-bottom: no}\n"
+    "setup: {key: c \\major, time: 4/4, tempo: 4 = 120}\n"
+    "version: 2.19.0\n"
+    "global-staff-size: 16\n",
+
+    "parts:\n"
+    "  violin: {name: [Violin, Vln.], relative: c'', instrument: violin}\n"
+    "  empty:\n"
+    "  piano:\n"
+    "    name: Piano\n"
+    "    type: PianoStaff\n"
+    "    parts:\n"
+    "      upper: {relative: c''}\n"
+    "      lower: {prefix: false, parts: {left: {name: [L]}}}\n"
+    "  drums: {type: DrumStaff}\n"
+    "score:\n"
+    "  midi:\n"
+    "  ignored: {a: [b, c]}\n"
+    "  parts: [violin, [empty, [piano]], drums]\n"
+    "  header: {piece: I}\n"
+    "  layout: {indent: 1\\cm}\n"
+    "---\n"
+    "book:\n"
+    "  - parts: [violin]\n"
+    "  - parts: []\n"
+    "    layout: ~\n",
+
+    "header: {title: &t Title, subtitle: *t}\n",
+  };
+
+  for(const char *input : inputs) {
+    INFO(input);
+    REQUIRE(from_events(input) == from_nodes(input));
+  }
+}
+
+TEST_CASE("Errors report the position", M) {
+  try {
+    from_events("parts:\n  violin: {nam: x}\n");
+    FAIL("no error");
+  }
+  catch(const Error &err) {
+    REQUIRE(string(err.what()) == "2:17: invalid key 'nam'");
+  }
+}
+
+TEST_CASE("Scores must have parts", M) {
+  REQUIRE_THROWS_AS(from_events("score: {layout: {}}"), const Error &);
+}
+
+TEST_CASE("Parts built in parallel", M) {
+  ostringstream input;
+  input << "parts:\n";
+  for(int i = 0; i < 100; i++)
+    input << "  part" << i << ": {relative: c', parts: {a: {}, b-" << i << ": {}}}\n";
+  input << "score: {parts: [part0, part99]}\n";
+
+  auto read = [&](unsigned int jobs, const FragmentCache *cache) {
+    Document doc;
+    istringstream stream(input.str());
+    YamlReader(doc, cache, jobs).read(stream);
+
+    ostringstream output;
+    output << doc.token();
+    return output.str();
+  };
+
+  const string expected = read(1, nullptr);
+  REQUIRE(read(4, nullptr) == expected);
+
+  FragmentCache cache;
+  REQUIRE(read(4, &cache) == expected);
+  REQUIRE(read(4, &cache) == expected);
+}
+
+TEST_CASE("Parts built in several batches", M) {
+  ostringstream input;
+  input << "parts:\n";
+  for(int i = 0; i < 700; i++)
+    input << "  part" << i << ": {relative: c'}\n";
+  input << "score: {parts: [part0, part350, part699]}\n";
+
+  auto read = [&](unsigned int jobs) {
+    Document doc;
+    istringstream stream(input.str());
+    YamlReader(doc, nullptr, jobs).read(stream);
+
+    ostringstream output;
+    output << doc.token();
+    return output.str();
+  };
+
+  const string expected = read(1);
+
+  // batches of 128 parts, the last 60 ones built serially
+  REQUIRE(read(2) == expected);
+}
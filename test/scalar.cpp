@@ -0,0 +1,74 @@
+#include "vendor/catch.hpp"
+
+#include <yaml-cpp/yaml.h>
+
+#include "../src/scalar.hpp"
+
+using namespace std;
+
+static const char *M = "[scalar]";
+
+// the exception-based classification make_value() used to do
+static ScalarType legacy_classify(const string &value, bool *boolean)
+{
+  const YAML::Node node(value);
+
+  try {
+    *boolean = node.as<bool>();
+    return BooleanScalar;
+  }
+  catch(YAML::BadConversion &) {}
+
+  try {
+    if(value.find('\\') != string::npos ||
+        value.find('#') == 0 || node.as<double>())
+      return LiteralScalar;
+  }
+  catch(YAML::BadConversion &) {}
+
+  return StringScalar;
+}
+
+static const char *CORPUS[] = {
+  "", " ", "a", "foo bar", "Lorem Ipsum", "violin", "acoustic grand",
+  "y", "Y", "n", "N", "yes", "Yes", "YES", "yEs", "YeS", "no", "No", "NO",
+  "true", "True", "TRUE", "tRUE", "TrUe", "false", "False", "FALSE",
+  "on", "On", "ON", "oN", "off", "Off", "OFF", "oFF", "yess", "t", "f",
+  "0", "1", "-1", "+1", "00", "0.0", "-0", "+0.0", "0e5", "0.000",
+  "1.5", ".5", "5.", "-.5", "+.5", ".", "-", "+", "-.", "1e", "1e+",
+  "1e5", "1E5", "1e-5", "1.5e+3", "e5", ".e5", "1.2.3", "1,5", "1_000",
+  "12abc", "abc12", "0x10", "0x1p3", "1 ", "1\t", " 1", "1 2",
+  "1e999", "-1e999", "1e-999", "1e-310", "inf", "-inf", "nan", "infinity",
+  ".inf", ".Inf", ".INF", "+.inf", "-.inf", "-.Inf", ".nan", ".NaN", ".NAN",
+  ".iNf", "0.7\\cm", "1\\cm", "\\major", "c \\major", "4/4", "4 = 120",
+  "##t", "#f", "#(set-paper-size \"a4\")", "a#b", "c''", "c,", "16",
+  "2.18.2", "letter",
+};
+
+TEST_CASE("Scalar classification parity", M) {
+  for(const char *value : CORPUS) {
+    bool expected_bool = false, actual_bool = false;
+
+    const ScalarType expected = legacy_classify(value, &expected_bool);
+    const ScalarType actual = classify_scalar(value, &actual_bool);
+
+    INFO("value: '" << value << "'");
+    REQUIRE(actual == expected);
+
+    if(expected == BooleanScalar)
+      REQUIRE(actual_bool == expected_bool);
+  }
+}
+
+TEST_CASE("Scalar number parsing", M) {
+  double value;
+
+  SECTION("Valid") {
+    REQUIRE(parse_double("-1.5e2", &value));
+    REQUIRE(value == -150);
+  }
+
+  SECTION("Invalid") {
+    REQUIRE_FALSE(parse_double("1.5cm", &value));
+  }
+}
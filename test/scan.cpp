@@ -0,0 +1,54 @@
+#include "vendor/catch.hpp"
+
+#include <string>
+
+#include "../src/scan.hpp"
+
+using namespace std;
+
+static const char *M = "[scan]";
+
+TEST_CASE("Quote and newline scanning", M) {
+  const ScanFunction kernels[] = {scalar_scan(), sse2_scan(), avx2_scan()};
+
+  for(const ScanFunction scan : kernels) {
+    if(!scan)
+      continue;
+
+    for(size_t size = 0; size < 100; size++) {
+      string text(size, 'a');
+      INFO("size " << size);
+
+      REQUIRE(scan(text.data(), text.data() + size) == text.data() + size);
+
+      for(size_t pos = 0; pos < size; pos++) {
+        INFO("position " << pos);
+
+        text[pos] = pos % 2 ? '"' : '\n';
+        REQUIRE(scan(text.data(), text.data() + size) == text.data() + pos);
+
+        // the same from an unaligned start
+        REQUIRE(scan(text.data() + pos, text.data() + size)
+          == text.data() + pos);
+
+        text[pos] = 'a';
+      }
+    }
+  }
+
+  SECTION("Every other byte is ignored") {
+    string text;
+    for(int c = 0; c < 256; c++) {
+      if(c != '"' && c != '\n')
+        text += static_cast<char>(c);
+    }
+
+    const char *end = text.data() + text.size();
+    REQUIRE(find_quote_or_newline(text.data(), end) == end);
+  }
+
+  SECTION("Kernel name") {
+    const string name = scan_kernel();
+    REQUIRE((name == "scalar" || name == "sse2" || name == "avx2"));
+  }
+}
@@ -93,6 +93,19 @@ TEST_CASE("Brace Blocks", M) {
     *tk << make_shared<EmptyToken>();
     REQUIRE(tk->code() == "{}");
   }
+
+  SECTION("Multi-line sub-tokens are indented") {
+    *tk << make_shared<Literal>("a\nb");
+    REQUIRE(tk->code() == "{\n  a\n  b\n}");
+  }
+
+  SECTION("Write at an indentation level") {
+    *tk << make_shared<TestToken>();
+
+    stringstream ss;
+    tk->write(ss, 1);
+    REQUIRE(ss.str() == "{\n    test\n  }");
+  }
 }
 
 TEST_CASE("Bracket Blocks", M) {
@@ -203,3 +216,194 @@ TEST_CASE("Comments", M) {
     REQUIRE(tk->code() == "% hello %\n% world %");
   }
 }
+
+TEST_CASE("Parallel write", M) {
+  TokenPtr<> root = make_shared<Token>();
+  auto staves = make_shared<Block>(Block::BracketStyle);
+
+  for(int i = 0; i < 50; i++) {
+    auto music = make_shared<Block>(Block::BraceStyle);
+    *music << make_shared<Literal>("a\nb");
+    *music << make_shared<EmptyToken>();
+
+    *staves << music;
+    *staves << make_shared<EmptyToken>();
+    *root << make_shared<Comment>("part\n" + to_string(i));
+  }
+
+  *root << staves;
+  *root << make_shared<EmptyToken>();
+
+  const ParallelWrite settings{4, 10};
+  ostringstream stream;
+  set_parallel(stream, &settings);
+
+  SECTION("Same output as the serial write") {
+    stream << root;
+    REQUIRE(stream.str() == root->code());
+  }
+
+  SECTION("Below the threshold") {
+    TokenPtr<> block = make_shared<Block>(Block::BraceStyle);
+    *block << make_shared<TestToken>();
+    stream << block;
+    REQUIRE(stream.str() == "{\n  test\n}");
+  }
+
+  SECTION("Disabled") {
+    set_parallel(stream, nullptr);
+    stream << root;
+    REQUIRE(stream.str() == root->code());
+  }
+}
+
+TEST_CASE("Memoized code", M) {
+  auto root = make_shared<Token>();
+  auto block = make_shared<Block>(Block::BraceStyle);
+  auto name = make_shared<String>("a");
+  auto variable = make_shared<Variable>("foo", name);
+
+  *block << variable;
+  *root << block;
+
+  REQUIRE(root->code() == "{\n  foo = \"a\"\n}\n");
+
+  SECTION("Leaf changes reach the cached blocks") {
+    *name = "b";
+    REQUIRE(root->code() == "{\n  foo = \"b\"\n}\n");
+  }
+
+  SECTION("Changing the value of a variable") {
+    auto other = make_shared<String>("c");
+    *variable = other;
+    REQUIRE(root->code() == "{\n  foo = \"c\"\n}\n");
+
+    *name = "ignored";
+    *other = "d";
+    REQUIRE(root->code() == "{\n  foo = \"d\"\n}\n");
+  }
+
+  SECTION("Adding children") {
+    *block << make_shared<TestToken>();
+    REQUIRE(root->code() == "{\n  foo = \"a\"\n  test\n}\n");
+  }
+
+  SECTION("Clearing children") {
+    block->clear();
+    REQUIRE(root->code() == "{}\n");
+
+    *block << variable;
+    *name = "b";
+    REQUIRE(root->code() == "{\n  foo = \"b\"\n}\n");
+  }
+
+  SECTION("Tokens with several parents") {
+    auto other = make_shared<Block>(Block::BracketStyle);
+    *other << block;
+    REQUIRE(other->code() == "<<\n  {\n    foo = \"a\"\n  }\n>>");
+
+    *name = "b";
+    REQUIRE(root->code() == "{\n  foo = \"b\"\n}\n");
+    REQUIRE(other->code() == "<<\n  {\n    foo = \"b\"\n  }\n>>");
+  }
+
+  SECTION("Parents outlived by their children") {
+    auto parent = make_shared<Block>(Block::BraceStyle);
+    *parent << name;
+    parent.reset();
+
+    *name = "b";
+    REQUIRE(root->code() == "{\n  foo = \"b\"\n}\n");
+  }
+
+  SECTION("Disabled") {
+    stringstream ss;
+    set_memo(ss, false);
+    *name = "b";
+    ss << TokenPtr<>(root);
+    REQUIRE(ss.str() == "{\n  foo = \"b\"\n}\n");
+  }
+
+  SECTION("Parallel streams") {
+    for(int i = 0; i < 20; i++)
+      *block << make_shared<Block>(Block::BraceStyle);
+
+    const ParallelWrite settings{4, 2};
+    const string expected = root->code();
+
+    for(const string value : {"a", "b"}) {
+      *name = value;
+
+      stringstream ss;
+      set_parallel(ss, &settings);
+      ss << TokenPtr<>(root);
+      REQUIRE(ss.str() == root->code());
+    }
+
+    REQUIRE(root->code() != expected);
+  }
+}
+
+TEST_CASE("Compact code", M) {
+  TokenPtr<> root = make_shared<Token>();
+  auto block = make_shared<Block>(Block::BraceStyle);
+  auto staves = make_shared<Block>(Block::BracketStyle);
+
+  *staves << make_shared<Literal>("a\nb");
+  *staves << make_shared<Comment>("x");
+
+  *block << make_shared<Variable>("foo", make_shared<String>("a\nb"));
+  *block << make_shared<EmptyToken>();
+  *block << staves;
+  *block << make_shared<Block>(Block::BraceStyle);
+
+  *root << make_shared<Comment>("hello", true);
+  *root << make_shared<Command>("version");
+  *root << block;
+
+  ostringstream stream;
+  set_compact(stream, true);
+
+  SECTION("Lilypond code") {
+    stream << root;
+    REQUIRE(stream.str() ==
+      "\\version\n{ foo = \"a\nb\" << a\nb >> {} }\n");
+  }
+
+  SECTION("Comments leave their block empty") {
+    TokenPtr<> only = make_shared<Block>(Block::BraceStyle);
+    *only << make_shared<Comment>("x");
+    stream << only;
+    REQUIRE(stream.str() == "{}");
+  }
+
+  SECTION("Line comments in literals end the line") {
+    TokenPtr<> music = make_shared<Block>(Block::BraceStyle);
+    *music << make_shared<Literal>("a % b\nc");
+    *music << make_shared<Literal>("d % e");
+    stream << music;
+    REQUIRE(stream.str() == "{ a % b\nc d % e\n }");
+  }
+
+  SECTION("Memoized code follows the mode") {
+    const string code = root->code();
+    stream << root;
+    REQUIRE(root->code() == code);
+
+    ostringstream again;
+    set_compact(again, true);
+    again << root;
+    REQUIRE(again.str() == stream.str());
+  }
+
+  SECTION("Parallel write") {
+    const ParallelWrite settings{4, 2};
+    set_parallel(stream, &settings);
+    stream << root;
+
+    ostringstream serial;
+    set_compact(serial, true);
+    serial << root;
+    REQUIRE(stream.str() == serial.str());
+  }
+}
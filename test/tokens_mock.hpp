@@ -5,13 +5,13 @@ class EmptyToken : public Token
 {
 public:
   bool empty() const { return true; }
-  std::string code() const { return ""; }
+  void write(std::ostream &, unsigned int) const {}
 };
 
 class TestToken : public Token
 {
 public:
-  std::string code() const { return "test"; }
+  void write(std::ostream &stream, unsigned int) const { stream << "test"; }
 };
 
 #endif
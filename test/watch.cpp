@@ -0,0 +1,52 @@
+#include "vendor/catch.hpp"
+
+#include <cstdlib>
+#include <fstream>
+#include <unistd.h>
+
+#include "../src/error.hpp"
+#include "../src/watch.hpp"
+
+using namespace std;
+
+static const char *M = "[watch]";
+
+#ifdef __linux__
+
+TEST_CASE("Watching files", M) {
+  char path[] = "/tmp/partman-watch-XXXXXX";
+  REQUIRE(mkdtemp(path));
+
+  const string watched = string(path) + "/score.yaml";
+  const string other = string(path) + "/other.yaml";
+
+  Watcher watcher;
+  watcher.add(watched);
+
+  // a burst of writes, including to a file that is not watched
+  for(int i = 0; i < 3; i++) {
+    ofstream(other) << i;
+    ofstream(watched) << i;
+  }
+
+  const vector<string> changed = watcher.wait(50);
+  REQUIRE(changed.size() == 1);
+  REQUIRE(changed[0] == watched);
+
+  SECTION("Replaced files") {
+    ofstream(other) << "new";
+    REQUIRE(rename(other.c_str(), watched.c_str()) == 0);
+
+    REQUIRE(watcher.wait(50) == vector<string>{watched});
+  }
+
+  system((string("rm -rf ") + path).c_str());
+}
+
+#else
+
+TEST_CASE("Watching files", M) {
+  REQUIRE_THROWS_AS(Watcher(), const Error &);
+}
+
+#endif